@@ -0,0 +1,108 @@
+#ifndef CRC32
+#define CRC32
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CN_HAVE_SSE42_CRC
+#endif
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78). It is the polynomial the SSE4.2 crc32 instruction
+// implements, so the hardware kernel and the portable slice-by-8 kernel produce identical checksums and
+// either end of a link may use whichever its CPU supports.
+
+struct Crc32cTables {
+    uint32_t table[8][256];
+};
+
+constexpr Crc32cTables MakeCrc32cTables() noexcept
+{
+    Crc32cTables tables {};
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78U : crc >> 1;
+        }
+        tables.table[0][byte] = crc;
+    }
+    for (int slice = 1; slice < 8; ++slice) {
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t prev             = tables.table[slice - 1][byte];
+            tables.table[slice][byte] = (prev >> 8) ^ tables.table[0][prev & 0xFF];
+        }
+    }
+    return tables;
+}
+
+inline constexpr Crc32cTables s_CRC32C_TABLES = MakeCrc32cTables();
+
+// Eight table lookups per 8-byte word instead of one per byte
+inline uint32_t Crc32cSliceBy8(uint32_t crc, unsigned char const* data, size_t len) noexcept
+{
+    auto const& table = s_CRC32C_TABLES.table;
+    crc               = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = table[7][word & 0xFF] ^ table[6][(word >> 8) & 0xFF] ^ table[5][(word >> 16) & 0xFF] ^ table[4][(word >> 24) & 0xFF]
+            ^ table[3][(word >> 32) & 0xFF] ^ table[2][(word >> 40) & 0xFF] ^ table[1][(word >> 48) & 0xFF] ^ table[0][word >> 56];
+    }
+#endif
+    for (; len > 0; ++data, --len) {
+        crc = table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(CN_HAVE_SSE42_CRC)
+__attribute__((target("sse4.2"))) inline uint32_t Crc32cSse42(uint32_t crc, unsigned char const* data, size_t len) noexcept
+{
+    uint64_t crc64 = ~crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc64);
+    for (; len > 0; ++data, --len) {
+        crc32 = _mm_crc32_u8(crc32, *data);
+    }
+    return ~crc32;
+}
+#endif
+
+using Crc32cKernel = uint32_t (*)(uint32_t, unsigned char const*, size_t) noexcept;
+
+inline Crc32cKernel SelectCrc32cKernel() noexcept
+{
+#if defined(CN_HAVE_SSE42_CRC)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return Crc32cSse42;
+    }
+#endif
+    return Crc32cSliceBy8;
+}
+
+inline char const* Crc32cKernelName() noexcept
+{
+#if defined(CN_HAVE_SSE42_CRC)
+    if (SelectCrc32cKernel() == Crc32cSse42) {
+        return "sse4.2";
+    }
+#endif
+    return "slice-by-8";
+}
+
+// `crc` continues a checksum over a previous span; pass 0 to start
+inline uint32_t Crc32c(void const* data, size_t len, uint32_t crc = 0) noexcept
+{
+    static Crc32cKernel const kernel = SelectCrc32cKernel();
+    return kernel(crc, static_cast<unsigned char const*>(data), len);
+}
+
+#endif
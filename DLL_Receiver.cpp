@@ -1,47 +1,260 @@
+#include <algorithm>
 #include <iostream>
+#include <cerrno>
+#include <csignal>
 #include <cstring>
 #include <chrono>
-#include <thread>
 #include <cstdlib>
+#include <string>
+#include <vector>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
-#define FRAME_SIZE 1024
+#include "DataLink.hpp"
 
-void WaitForEvent();
-void ReceiveFrame(int connfd, char* frame);
-void ExtractData(char* frame, char* data);
-void DeliverData(char* data);
+#define FRAME_SIZE s_MAX_LINK_PAYLOAD
+#define READ_SIZE  (64 * 1024)
+#define MAX_FILE_SIZE (uint64_t { 1 } << 36)   // 64 GiB; a larger announcement is refused rather than mapped
 
-void WaitForEvent()
+using Clock = std::chrono::steady_clock;
+
+// Output of a file transfer, mapped at its announced size so payloads land in the page cache directly
+struct OutputFile {
+    char* data;
+    uint64_t size;
+    int64_t frames;
+    int64_t last;   // highest frame index seen, anchors unwrapping of 16-bit sequence numbers
+    bool announced;
+    bool refused;   // the announcement could not be honoured, so the session is dropped
+    std::vector<bool> written;
+    int64_t unique;
+    int64_t misplaced;
+};
+
+// One connected sender. Everything a transfer needs lives here, so sessions never share state and the table
+// stays dense: closing a session moves the last one into its place, mirroring the poll set behind the listener.
+struct Session {
+    int fd;
+    int id;
+    char peer[INET_ADDRSTRLEN + 8];
+    Clock::time_point start;
+    Deframer deframer;
+    int64_t frames;     // delivered
+    uint64_t bytes;     // delivered payload, the goodput numerator
+    std::string path;   // file mode only
+    OutputFile out;
+};
+
+struct Totals {
+    int failed;
+    int64_t frames;
+    uint64_t bytes;
+    Clock::time_point first;   // first accept
+    Clock::time_point last;    // last close
+};
+
+volatile sig_atomic_t stop_requested = 0;
+
+void RequestStop(int);
+void ExtractData(char const* payload, size_t len, char* data);
+void DeliverData(int seq, char* data);
+bool MapOutputFile(char const* path, OutputFile& out);
+void WriteFilePayload(OutputFile& out, uint16_t seq, char const* payload, size_t len);
+void OpenSession(std::vector<Session>& sessions, std::vector<pollfd>& fds, int connfd, sockaddr_in const& cli, char const* output_path, int id);
+bool ServeSession(Session& session, bool file_mode);
+void CloseSession(std::vector<Session>& sessions, std::vector<pollfd>& fds, size_t index, Totals& totals);
+
+void RequestStop(int)
 {
-    std::cout << "Waiting for frame..." << std::endl;
-    int wait_time = 500 + std::rand() % 1500;
-    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    stop_requested = 1;
 }
 
-void ReceiveFrame(int connfd, char* frame)
+// Feeds whatever the stream has to the deframer, which calls on_frame for every intact frame.
+// Returns false once the sender has closed or reset the connection.
+template <typename OnFrame>
+bool ReadFrames(int connfd, Deframer& deframer, OnFrame&& on_frame)
 {
-    int n = read(connfd, frame, FRAME_SIZE);
+    char buffer[READ_SIZE];
+    ssize_t n = read(connfd, buffer, READ_SIZE);
     if (n < 0) {
-        std::cerr << "Error in receiving frame" << std::endl;
-        exit(EXIT_FAILURE);
+        if (errno == EINTR) {
+            return true;
+        }
+        std::cerr << "Error in receiving frame: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (n == 0) {
+        return false;
     }
-    frame[n] = 0;
+    deframer.feed(buffer, n, on_frame);
+    return true;
+}
+
+void ExtractData(char const* payload, size_t len, char* data)
+{
+    memcpy(data, payload, len);
+    data[len] = '\0';
 }
 
-void ExtractData(char* frame, char* data)
+void DeliverData(int seq, char* data)
 {
-    strncpy(data, frame, FRAME_SIZE);
+    std::cout << "Received frame " << seq << ": " << data << std::endl;
 }
 
-void DeliverData(char* data)
+// The size comes from the peer, so failing here costs only this session, never the receiver
+bool MapOutputFile(char const* path, OutputFile& out)
 {
-    std::cout << "Received frame: " << data << std::endl;
+    if (out.size > MAX_FILE_SIZE) {
+        std::cerr << "Refusing " << path << ": announced " << out.size << " bytes, more than " << MAX_FILE_SIZE << std::endl;
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, out.size) != 0) {
+        std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+        if (fd != -1) {
+            close(fd);
+            unlink(path);
+        }
+        return false;
+    }
+    if (out.size > 0) {
+        void* data = mmap(nullptr, out.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            std::cerr << "Cannot map " << path << ": " << strerror(errno) << std::endl;
+            close(fd);
+            unlink(path);
+            return false;
+        }
+        madvise(data, out.size, MADV_SEQUENTIAL);
+        out.data = static_cast<char*>(data);
+    }
+    close(fd);   // the mapping keeps the file referenced
+    out.frames    = (out.size + FRAME_SIZE - 1) / FRAME_SIZE;
+    out.announced = true;
+    out.written.assign(out.frames, false);
+    return true;
 }
 
-void Receiver(char const* ip, int port)
+// Frames reach the stream in index order give or take the link's reordering, so the index closest to the
+// highest one seen is the right reading of a wrapped sequence number
+void WriteFilePayload(OutputFile& out, uint16_t seq, char const* payload, size_t len)
+{
+    int64_t index   = out.last + static_cast<int16_t>(seq - static_cast<uint16_t>(out.last));
+    uint64_t offset = static_cast<uint64_t>(index) * FRAME_SIZE;
+    bool fits       = index >= 0 && index < out.frames;
+    if (!fits || len != std::min<uint64_t>(FRAME_SIZE, out.size - offset)) {
+        ++out.misplaced;
+        return;
+    }
+    memcpy(out.data + offset, payload, len);
+    if (!out.written[index]) {
+        out.written[index] = true;
+        ++out.unique;
+    }
+    out.last = std::max(out.last, index);
+}
+
+// Session 1 writes OUTPUT itself, so a single transfer behaves as it always has; later ones get OUTPUT.<id>
+void OpenSession(std::vector<Session>& sessions, std::vector<pollfd>& fds, int connfd, sockaddr_in const& cli, char const* output_path, int id)
+{
+    sessions.emplace_back();
+    Session& session = sessions.back();
+    session.fd       = connfd;
+    session.id       = id;
+    session.start    = Clock::now();
+    char host[INET_ADDRSTRLEN] {};
+    inet_ntop(AF_INET, &cli.sin_addr, host, sizeof(host));
+    snprintf(session.peer, sizeof(session.peer), "%s:%d", host, ntohs(cli.sin_port));
+    if (output_path != nullptr) {
+        session.path = id == 1 ? output_path : std::string(output_path) + "." + std::to_string(id);
+    }
+    fds.push_back({ connfd, POLLIN, 0 });
+    std::cout << "Connection established (session " << id << ", " << session.peer << ")." << std::endl;
+}
+
+// The deframer's unstuffing buffer is the only staging area: a payload is copied from it once, into the
+// mapping, after its CRC has passed, so a damaged header can never scribble over good data.
+// Returns false when the session has ended.
+bool ServeSession(Session& session, bool file_mode)
+{
+    if (!file_mode) {
+        char data[FRAME_SIZE + 1];
+        return ReadFrames(session.fd, session.deframer, [&](uint16_t seq, char const* payload, size_t len) {
+            ExtractData(payload, len, data);
+            DeliverData(seq, data);
+            ++session.frames;
+            session.bytes += len;
+        });
+    }
+
+    OutputFile& out = session.out;
+    bool alive      = ReadFrames(session.fd, session.deframer, [&](uint16_t seq, char const* payload, size_t len) {
+        if (out.refused) {
+            return;
+        }
+        if (out.announced) {
+            int64_t unique = out.unique;
+            WriteFilePayload(out, seq, payload, len);
+            if (out.unique != unique) {
+                ++session.frames;
+                session.bytes += len;
+            }
+        } else if (DecodeFileAnnouncement(payload, len, out.size)) {
+            out.refused   = !MapOutputFile(session.path.c_str(), out);
+            session.start = Clock::now();
+        } else {
+            ++out.misplaced;
+        }
+    });
+    return alive && !out.refused;
+}
+
+void CloseSession(std::vector<Session>& sessions, std::vector<pollfd>& fds, size_t index, Totals& totals)
+{
+    Session& session = sessions[index];
+    OutputFile& out  = session.out;
+    auto now         = Clock::now();
+    double seconds   = std::chrono::duration<double>(now - session.start).count();
+    double goodput   = seconds > 0 ? session.bytes / seconds / 1e6 : 0;
+
+    if (out.refused) {
+        std::cerr << "Session " << session.id << " (" << session.peer << ") dropped: its file could not be received." << std::endl;
+        ++totals.failed;
+    } else if (!session.path.empty() && !out.announced) {
+        std::cerr << "Session " << session.id << " (" << session.peer << ") closed before the file was announced." << std::endl;
+        ++totals.failed;
+    } else if (!session.path.empty()) {
+        if (out.data != nullptr) {
+            munmap(out.data, out.size);
+        }
+        std::cout << "Received " << session.path << ": " << out.unique << " of " << out.frames << " frames (" << out.size << " bytes) in "
+                  << seconds << " s (" << (seconds > 0 ? out.size / seconds / 1e6 : 0) << " MB/s), " << out.frames - out.unique << " missing, rejected "
+                  << session.deframer.rejected() << " damaged and " << out.misplaced << " misplaced frames" << std::endl;
+    } else {
+        std::cout << "Session " << session.id << " (" << session.peer << "): received " << session.frames << " frames (" << session.bytes
+                  << " bytes) in " << seconds << " s (" << goodput << " MB/s goodput), rejected " << session.deframer.rejected()
+                  << " damaged frames" << std::endl;
+    }
+
+    totals.frames += session.frames;
+    totals.bytes += session.bytes;
+    totals.last = now;
+    close(session.fd);
+    if (index + 1 != sessions.size()) {
+        sessions[index] = std::move(sessions.back());
+        fds[index + 1]  = fds.back();
+    }
+    sessions.pop_back();
+    fds.pop_back();
+}
+
+// Serves up to `max_sessions` senders at once from one poll loop, or any number until interrupted when it is 0.
+// Each session keeps its own deframer and counters, so a slow or damaged stream never holds up the others.
+int Receiver(char const* ip, int port, char const* output_path, int max_sessions)
 {
     int sockfd, connfd;
     struct sockaddr_in servaddr, cli;
@@ -65,48 +278,95 @@ void Receiver(char const* ip, int port)
         exit(EXIT_FAILURE);
     }
 
-    if ((listen(sockfd, 1)) != 0) {
+    if ((listen(sockfd, SOMAXCONN)) != 0) {
         std::cerr << "Listen failed." << std::endl;
         exit(EXIT_FAILURE);
     } else {
         std::cout << "Listening for connections..." << std::endl;
     }
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
 
-    socklen_t len = sizeof(cli);
+    struct sigaction action {};
+    action.sa_handler = RequestStop;   // no SA_RESTART, so poll returns and the totals still get printed
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
 
-    connfd = accept(sockfd, (struct sockaddr*)&cli, &len);
-    if (connfd < 0) {
-        std::cerr << "Server accept failed." << std::endl;
-        exit(EXIT_FAILURE);
-    } else {
-        std::cout << "Connection established." << std::endl;
-    }
+    std::vector<Session> sessions;
+    std::vector<pollfd> fds { { sockfd, POLLIN, 0 } };   // listener, then one entry per session in table order
+    Totals totals {};
+    int accepted = 0;
+
+    while (!stop_requested && (max_sessions == 0 || accepted < max_sessions || !sessions.empty())) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Poll failed: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
 
-    char frame[FRAME_SIZE];
-    char data[FRAME_SIZE];
+        // Backwards, so the session moved into a closed one's place has already been served
+        for (size_t index = sessions.size(); index-- > 0;) {
+            if (fds[index + 1].revents != 0 && !ServeSession(sessions[index], output_path != nullptr)) {
+                CloseSession(sessions, fds, index, totals);
+            }
+        }
 
-    while (true) {
-        WaitForEvent();
-        ReceiveFrame(connfd, frame);
-        if (!frame[0]) break;
-        ExtractData(frame, data);
-        DeliverData(data);
+        while ((fds[0].revents & POLLIN) && (max_sessions == 0 || accepted < max_sessions)) {
+            socklen_t len = sizeof(cli);
+            connfd        = accept(sockfd, (struct sockaddr*)&cli, &len);
+            if (connfd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    std::cerr << "Server accept failed." << std::endl;
+                }
+                break;
+            }
+            if (accepted++ == 0) {
+                totals.first = Clock::now();
+            }
+            OpenSession(sessions, fds, connfd, cli, output_path, accepted);
+        }
+        if (max_sessions != 0 && accepted == max_sessions) {
+            fds[0].fd = -1;   // poll skips negative descriptors; later senders wait in the backlog until exit
+        }
     }
 
-    close(connfd);
+    while (!sessions.empty()) {
+        CloseSession(sessions, fds, sessions.size() - 1, totals);
+    }
     close(sockfd);
+
+    double seconds = std::chrono::duration<double>(totals.last - totals.first).count();
+    std::cout << "All sessions: " << accepted << " served, " << totals.frames << " frames (" << totals.bytes << " bytes) in " << seconds
+              << " s (" << (seconds > 0 ? totals.bytes / seconds / 1e6 : 0) << " MB/s aggregate goodput)" << std::endl;
+    return totals.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <IP> <Port>" << std::endl;
+    char const* output_path = nullptr;
+    int max_sessions        = 1;
+    bool valid              = argc >= 3;
+    for (int arg = 3; valid && arg < argc; arg += 2) {
+        if (arg + 1 < argc && strcmp(argv[arg], "--file") == 0) {
+            output_path = argv[arg + 1];
+        } else if (arg + 1 < argc && strcmp(argv[arg], "--sessions") == 0) {
+            max_sessions = std::atoi(argv[arg + 1]);
+            valid        = max_sessions >= 0;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid) {
+        std::cerr << "Usage: " << argv[0] << " <IP> <Port> [--file OUTPUT] [--sessions N (0 serves until interrupted)]" << std::endl;
         return EXIT_FAILURE;
     }
 
     char const* ip = argv[1];
     int port       = std::stoi(argv[2]);
 
-    Receiver(ip, port);
-    return 0;
+    return Receiver(ip, port, output_path, max_sessions);
 }
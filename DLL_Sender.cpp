@@ -1,43 +1,159 @@
+#include <algorithm>
 #include <iostream>
+#include <cerrno>
 #include <cstring>
 #include <chrono>
-#include <thread>
 #include <cstdlib>
+#include <memory>
+#include <vector>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define FRAME_SIZE   1024
+#include "DataLink.hpp"
+#include "LinkEmulator.hpp"
+#include "Pacer.hpp"
+
+#define FRAME_SIZE   s_MAX_LINK_PAYLOAD
 #define TOTAL_FRAMES 10
+#define BATCH_SIZE   (64 * 1024)   // Encoded bytes gathered per write when the link needs no emulation
 
-void WaitForEvent(int frame_number);
 void GetData(char* data, int frame_number);
-void MakeFrame(char* data, char* frame);
-void SendFrame(int sockfd, char* frame);
+size_t MakeFrame(char* data, char* frame, int frame_number);
+void SendFrame(LinkEmulator& link, char* frame, size_t frame_len, char* data);
+char const* MapInputFile(char const* path, size_t& size);
+bool WriteAll(int sockfd, char const* data, size_t len);
+void SendFile(int sockfd, char const* path, LinkConfig const& link_config, PacingConfig const& pacing);
 
-void WaitForEvent(int frame_number)
+void GetData(char* data, int frame_number)
 {
-    int wait_time = 500 + std::rand() % 1000;
-    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    snprintf(data, FRAME_SIZE, "Frame %d", frame_number);
 }
 
-void GetData(char* data, int frame_number)
+// Only the payload's own length goes into the frame; the sequence number wraps at 16 bits
+size_t MakeFrame(char* data, char* frame, int frame_number)
 {
-    snprintf(data, FRAME_SIZE, "Frame %d", frame_number);
+    size_t len = strnlen(data, FRAME_SIZE);
+    return EncodeLinkFrame(frame, static_cast<uint16_t>(frame_number), data, static_cast<uint16_t>(len));
+}
+
+void SendFrame(LinkEmulator& link, char* frame, size_t frame_len, char* data)
+{
+    link.send(frame, frame_len);
+    std::cout << "Sending frame: " << data << std::endl;
 }
 
-void MakeFrame(char* data, char* frame)
+char const* MapInputFile(char const* path, size_t& size)
 {
-    strncpy(frame, data, FRAME_SIZE);
-    frame[FRAME_SIZE - 1] = '\0';   // Ensure null-termination
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0) {
+        std::cerr << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    size = info.st_size;
+    if (size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);   // the mapping keeps the file referenced
+    if (file == MAP_FAILED) {
+        std::cerr << "Cannot map " << path << ": " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    madvise(file, size, MADV_SEQUENTIAL);
+    return static_cast<char const*>(file);
 }
 
-void SendFrame(int sockfd, char* frame)
+bool WriteAll(int sockfd, char const* data, size_t len)
 {
-    send(sockfd, frame, FRAME_SIZE, 0);
-    std::cout << "Sending frame: " << frame << std::endl;
+    while (len > 0) {
+        ssize_t n = send(sockfd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
 }
 
-void Sender(char const* ip, int port)
+// Frames are encoded straight out of the file mapping, so payload bytes are only ever read in place.
+// Stuffing and the CRC rewrite every byte, which rules out handing the file to sendfile/splice; what
+// remains is keeping syscalls off the per-frame path: on an ideal link frames are gathered into
+// BATCH_SIZE writes, otherwise each one goes through the emulator so impairments stay per frame. A paced
+// send writes every frame as soon as the bucket lets it go, so batching would only turn the rate into bursts.
+void SendFile(int sockfd, char const* path, LinkConfig const& link_config, PacingConfig const& pacing)
+{
+    size_t file_size;
+    char const* file = MapInputFile(path, file_size);
+    size_t frames    = (file_size + FRAME_SIZE - 1) / FRAME_SIZE;
+
+    // Part of connection setup rather than the data path, so it bypasses the emulated link
+    char frame[s_MAX_ENCODED_LINK_FRAME];
+    size_t wire_bytes = EncodeFileAnnouncement(frame, file_size);
+    if (!WriteAll(sockfd, frame, wire_bytes)) {
+        std::cerr << "Error sending file announcement." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::unique_ptr<LinkEmulator> link;
+    if (!IsIdealLink(link_config)) {
+        link = std::make_unique<LinkEmulator>(sockfd, link_config, 1);
+    }
+    std::vector<char> batch(BATCH_SIZE + s_MAX_ENCODED_LINK_FRAME);
+    size_t batched     = 0;
+    size_t batch_limit = pacing.rate_kbps > 0 ? 1 : BATCH_SIZE;
+    TokenBucket pacer { pacing.rate_kbps * 1000 / 8, 2.0 * s_MAX_ENCODED_LINK_FRAME };
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < frames; ++i) {
+        size_t offset = i * FRAME_SIZE;
+        uint16_t len  = static_cast<uint16_t>(std::min<size_t>(FRAME_SIZE, file_size - offset));
+        if (link) {
+            size_t frame_len = EncodeLinkFrame(frame, static_cast<uint16_t>(i), file + offset, len);
+            pacer.pace(frame_len);
+            if (!link->send(frame, frame_len)) {
+                std::cerr << "Error sending frame." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            wire_bytes += frame_len;
+            continue;
+        }
+        batched += EncodeLinkFrame(batch.data() + batched, static_cast<uint16_t>(i), file + offset, len);
+        if (batched >= batch_limit || i + 1 == frames) {
+            pacer.pace(batched);
+            if (!WriteAll(sockfd, batch.data(), batched)) {
+                std::cerr << "Error sending frame." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            wire_bytes += batched;
+            batched = 0;
+        }
+    }
+
+    LinkEmulator::Stats link_stats = link ? link->stats() : LinkEmulator::Stats {};
+    link.reset();   // waits for every frame still on the emulated link
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Sent " << path << " (" << file_size << " bytes, " << frames << " frames, " << wire_bytes << " bytes on the wire) in "
+              << seconds << " s (" << file_size / seconds / 1e6 << " MB/s), CRC32C kernel " << Crc32cKernelName() << std::endl;
+    if (!IsIdealLink(link_config)) {
+        std::cout << "Link: " << link_stats.sent << " sent, " << link_stats.dropped << " dropped, " << link_stats.duplicated
+                  << " duplicated, " << link_stats.reordered << " reordered, " << link_stats.corrupted << " corrupted" << std::endl;
+    }
+    if (pacer.rate() > 0) {
+        std::cout << "Pacing: " << pacing.rate_kbps << " kbps, " << wire_bytes * 8 / 1000 / seconds << " kbps achieved on the wire, "
+                  << pacer.waits() << " waits" << std::endl;
+    }
+    if (file != nullptr) {
+        munmap(const_cast<char*>(file), file_size);
+    }
+}
+
+void Sender(char const* ip, int port, int total_frames, char const* file_path, LinkConfig const& link_config, PacingConfig const& pacing)
 {
     int sockfd;
     struct sockaddr_in servaddr;
@@ -61,29 +177,59 @@ void Sender(char const* ip, int port)
         exit(EXIT_FAILURE);
     }
 
+    if (file_path != nullptr) {
+        SendFile(sockfd, file_path, link_config, pacing);
+        close(sockfd);
+        return;
+    }
+
+    auto link = std::make_unique<LinkEmulator>(sockfd, link_config, 1);
     char data[FRAME_SIZE];
-    char frame[FRAME_SIZE];
+    char frame[s_MAX_ENCODED_LINK_FRAME];
+    size_t wire_bytes = 0;
+    TokenBucket pacer { pacing.rate_kbps * 1000 / 8, 2.0 * s_MAX_ENCODED_LINK_FRAME };
+    auto start = std::chrono::steady_clock::now();
 
-    for (int i = 0; i < TOTAL_FRAMES; ++i) {
+    for (int i = 0; i < total_frames; ++i) {
         GetData(data, i);
-        MakeFrame(data, frame);
-        SendFrame(sockfd, frame);
-        WaitForEvent(i);
+        size_t frame_len = MakeFrame(data, frame, i);
+        pacer.pace(frame_len);
+        SendFrame(*link, frame, frame_len, data);
+        wire_bytes += frame_len;
     }
 
+    LinkEmulator::Stats link_stats = link->stats();
+    link.reset();   // waits for every frame still on the emulated link
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Sent " << total_frames << " frames (" << wire_bytes << " bytes on the wire) in " << seconds << " s ("
+              << total_frames / seconds << " frames/s), CRC32C kernel " << Crc32cKernelName() << std::endl;
+    std::cout << "Link: " << link_stats.sent << " sent, " << link_stats.dropped << " dropped, " << link_stats.duplicated
+              << " duplicated, " << link_stats.reordered << " reordered, " << link_stats.corrupted << " corrupted" << std::endl;
+    if (pacer.rate() > 0) {
+        std::cout << "Pacing: " << pacing.rate_kbps << " kbps, " << wire_bytes * 8 / 1000 / seconds << " kbps achieved on the wire, "
+                  << pacer.waits() << " waits" << std::endl;
+    }
     close(sockfd);
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <IP> <Port>" << std::endl;
+    LinkConfig link_config = ExtractLinkConfig(argc, argv);
+    PacingConfig pacing    = ExtractPacingConfig(argc, argv);
+    if (pacing.aimd) {
+        std::cerr << "--aimd needs acknowledgements, which this link does not carry; use --rate." << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool file_mode = argc == 5 && strcmp(argv[3], "--file") == 0;
+    if (argc != 3 && argc != 4 && !file_mode) {
+        std::cerr << "Usage: " << argv[0] << " <IP> <Port> [Frames | --file PATH] [--rate KBPS] [--link latency=MS,jitter=MS,rate=KBPS,loss=P,dup=P,reorder=P,corrupt=P,seed=N]" << std::endl;
         return EXIT_FAILURE;
     }
 
-    char const* ip = argv[1];
-    int port       = std::stoi(argv[2]);
+    char const* ip   = argv[1];
+    int port         = std::stoi(argv[2]);
+    int total_frames = argc == 4 ? std::stoi(argv[3]) : TOTAL_FRAMES;
 
-    Sender(ip, port);
+    Sender(ip, port, total_frames, file_mode ? argv[4] : nullptr, link_config, pacing);
     return 0;
 }
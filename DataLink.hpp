@@ -0,0 +1,162 @@
+#ifndef DATA_LINK
+#define DATA_LINK
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Crc32.hpp"
+
+// HDLC-style framing for the DLL programs. On the wire a frame is
+//
+//   FLAG | stuffed( seq u16 | length u16 | payload | crc32c u32 ) | FLAG
+//
+// with big-endian fields and the CRC covering header and payload. Inside the flags every FLAG or ESCAPE
+// byte is sent as ESCAPE followed by the byte XOR 0x20, so a FLAG on the wire always delimits a frame
+// and the receiver can resynchronise after damage by waiting for the next one.
+
+constexpr unsigned char s_LINK_FLAG { 0x7E };
+constexpr unsigned char s_LINK_ESCAPE { 0x7D };
+constexpr unsigned char s_LINK_ESCAPE_XOR { 0x20 };
+constexpr size_t s_LINK_HEADER_SIZE { 4 };
+constexpr size_t s_LINK_TRAILER_SIZE { 4 };
+constexpr size_t s_MAX_LINK_PAYLOAD { 1024 };
+constexpr size_t s_MAX_LINK_FRAME { s_LINK_HEADER_SIZE + s_MAX_LINK_PAYLOAD + s_LINK_TRAILER_SIZE };
+constexpr size_t s_MAX_ENCODED_LINK_FRAME { 2 + 2 * s_MAX_LINK_FRAME };   // every byte escaped, plus both flags
+
+inline size_t StuffBytes(unsigned char const* in, size_t len, unsigned char* out) noexcept
+{
+    size_t written = 0;
+    for (size_t index = 0; index < len; ++index) {
+        if (in[index] == s_LINK_FLAG || in[index] == s_LINK_ESCAPE) {
+            out[written++] = s_LINK_ESCAPE;
+            out[written++] = in[index] ^ s_LINK_ESCAPE_XOR;
+        } else {
+            out[written++] = in[index];
+        }
+    }
+    return written;
+}
+
+// Writes the complete encoded frame to `out` (at least s_MAX_ENCODED_LINK_FRAME bytes) and returns its length.
+// The payload is checksummed and stuffed where it lies, so it may point straight into a mapped file.
+inline size_t EncodeLinkFrame(char* out, uint16_t seq, char const* payload, uint16_t len) noexcept
+{
+    unsigned char header[s_LINK_HEADER_SIZE] {
+        static_cast<unsigned char>(seq >> 8),
+        static_cast<unsigned char>(seq),
+        static_cast<unsigned char>(len >> 8),
+        static_cast<unsigned char>(len),
+    };
+    uint32_t crc = Crc32c(payload, len, Crc32c(header, s_LINK_HEADER_SIZE));
+    unsigned char trailer[s_LINK_TRAILER_SIZE];
+    for (size_t byte = 0; byte < s_LINK_TRAILER_SIZE; ++byte) {
+        trailer[byte] = static_cast<unsigned char>(crc >> (24 - 8 * byte));
+    }
+
+    auto* encoded   = reinterpret_cast<unsigned char*>(out);
+    size_t size     = 0;
+    encoded[size++] = s_LINK_FLAG;
+    size += StuffBytes(header, s_LINK_HEADER_SIZE, encoded + size);
+    size += StuffBytes(reinterpret_cast<unsigned char const*>(payload), len, encoded + size);
+    size += StuffBytes(trailer, s_LINK_TRAILER_SIZE, encoded + size);
+    encoded[size++] = s_LINK_FLAG;
+    return size;
+}
+
+// A file transfer opens with one announcement frame so the receiver can size its output before any data
+// arrives. Data frame k then carries bytes [k * s_MAX_LINK_PAYLOAD, ...) of the file with seq k mod 2^16.
+constexpr char s_FILE_ANNOUNCE_MAGIC[] { 'C', 'N', 'F', 'I', 'L', 'E' };
+constexpr size_t s_FILE_ANNOUNCE_SIZE { sizeof(s_FILE_ANNOUNCE_MAGIC) + 8 };
+
+inline size_t EncodeFileAnnouncement(char* out, uint64_t file_size) noexcept
+{
+    char payload[s_FILE_ANNOUNCE_SIZE];
+    std::memcpy(payload, s_FILE_ANNOUNCE_MAGIC, sizeof(s_FILE_ANNOUNCE_MAGIC));
+    for (size_t byte = 0; byte < 8; ++byte) {
+        payload[sizeof(s_FILE_ANNOUNCE_MAGIC) + byte] = static_cast<char>(file_size >> (56 - 8 * byte));
+    }
+    return EncodeLinkFrame(out, 0, payload, s_FILE_ANNOUNCE_SIZE);
+}
+
+inline bool DecodeFileAnnouncement(char const* payload, size_t len, uint64_t& file_size) noexcept
+{
+    if (len != s_FILE_ANNOUNCE_SIZE || std::memcmp(payload, s_FILE_ANNOUNCE_MAGIC, sizeof(s_FILE_ANNOUNCE_MAGIC)) != 0) {
+        return false;
+    }
+    file_size = 0;
+    for (size_t byte = 0; byte < 8; ++byte) {
+        file_size = file_size << 8 | static_cast<unsigned char>(payload[sizeof(s_FILE_ANNOUNCE_MAGIC) + byte]);
+    }
+    return true;
+}
+
+// Incremental receiver side. Bytes may arrive in any split; feed() calls on_frame(seq, payload, length)
+// for every intact frame. Damaged frames are dropped by the cheapest failing check: oversize while
+// unstuffing, then a length field that disagrees with the bytes between the flags, then the CRC.
+class Deframer {
+public:
+    template <typename OnFrame>
+    void feed(char const* data, size_t len, OnFrame&& on_frame) noexcept
+    {
+        for (size_t index = 0; index < len; ++index) {
+            unsigned char byte = static_cast<unsigned char>(data[index]);
+            if (byte == s_LINK_FLAG) {
+                m_finish(on_frame);
+                continue;
+            }
+            if (m_discarding) {
+                continue;
+            }
+            if (byte == s_LINK_ESCAPE) {
+                m_escaped = true;
+                continue;
+            }
+            if (m_size == s_MAX_LINK_FRAME) {
+                m_discarding = true;
+                continue;
+            }
+            m_raw[m_size++] = m_escaped ? byte ^ s_LINK_ESCAPE_XOR : byte;
+            m_escaped       = false;
+        }
+    }
+
+    size_t accepted() const noexcept { return m_accepted; }
+    size_t rejected() const noexcept { return m_rejected; }
+
+private:
+    template <typename OnFrame>
+    void m_finish(OnFrame&& on_frame) noexcept
+    {
+        // Back-to-back flags (the closing flag of one frame, the opening flag of the next) carry nothing
+        if (m_size != 0 || m_discarding) {
+            bool intact   = !m_discarding && m_size >= s_LINK_HEADER_SIZE + s_LINK_TRAILER_SIZE;
+            size_t length = intact ? static_cast<size_t>(m_raw[2]) << 8 | m_raw[3] : 0;
+            if (!intact || length != m_size - s_LINK_HEADER_SIZE - s_LINK_TRAILER_SIZE || !m_crc_matches(length)) {
+                ++m_rejected;
+            } else {
+                ++m_accepted;
+                on_frame(static_cast<uint16_t>(m_raw[0] << 8 | m_raw[1]), reinterpret_cast<char const*>(m_raw + s_LINK_HEADER_SIZE), length);
+            }
+        }
+        m_size       = 0;
+        m_escaped    = false;
+        m_discarding = false;
+    }
+
+    bool m_crc_matches(size_t length) const noexcept
+    {
+        unsigned char const* trailer = m_raw + s_LINK_HEADER_SIZE + length;
+        uint32_t expected            = static_cast<uint32_t>(trailer[0]) << 24 | trailer[1] << 16 | trailer[2] << 8 | trailer[3];
+        return Crc32c(m_raw, s_LINK_HEADER_SIZE + length) == expected;
+    }
+
+    unsigned char m_raw[s_MAX_LINK_FRAME];
+    size_t m_size {};
+    size_t m_accepted {};
+    size_t m_rejected {};
+    bool m_escaped {};
+    bool m_discarding {};
+};
+
+#endif
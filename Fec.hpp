@@ -0,0 +1,247 @@
+#ifndef FEC
+#define FEC
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CN_HAVE_X86_GF
+#endif
+
+// Erasure coding over GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D). A block of k data packets
+// is protected by repair packets r = 0, 1, ... where repair r is the sum over j of C[r][j] * data[j] and
+//
+//   C[r][j] = (K ^ j) / ((K + r) ^ j)
+//
+// for the nominal block size K. That is a Cauchy matrix with its columns scaled so row 0 is all ones: the first
+// repair is plain XOR parity, and any k of the k + m packets of a block, data or repair, rebuild the rest.
+// K + m may not exceed 256. Shorter packets count as zero-padded to the block's repair length.
+
+struct GfTables {
+    uint8_t exp[512];   // doubled so a product of two logs never needs a modulo
+    uint8_t log[256];
+    uint8_t low[256][16];    // low[c][n] = c * n, for the low nibble of a byte
+    uint8_t high[256][16];   // high[c][n] = c * (n << 4)
+};
+
+constexpr GfTables MakeGfTables() noexcept
+{
+    GfTables tables {};
+    uint32_t value = 1;
+    for (uint32_t power = 0; power < 255; ++power) {
+        tables.exp[power]       = static_cast<uint8_t>(value);
+        tables.exp[power + 255] = static_cast<uint8_t>(value);
+        tables.log[value]       = static_cast<uint8_t>(power);
+        value <<= 1;
+        if (value & 0x100) {
+            value ^= 0x11D;
+        }
+    }
+    for (uint32_t c = 1; c < 256; ++c) {
+        for (uint32_t n = 1; n < 16; ++n) {
+            tables.low[c][n]  = tables.exp[tables.log[c] + tables.log[n]];
+            tables.high[c][n] = tables.exp[tables.log[c] + tables.log[n << 4]];
+        }
+    }
+    return tables;
+}
+
+inline constexpr GfTables s_GF_TABLES = MakeGfTables();
+
+inline uint8_t GfMul(uint8_t lhs, uint8_t rhs) noexcept
+{
+    return lhs == 0 || rhs == 0 ? 0 : s_GF_TABLES.exp[s_GF_TABLES.log[lhs] + s_GF_TABLES.log[rhs]];
+}
+
+inline uint8_t GfInverse(uint8_t value) noexcept
+{
+    return s_GF_TABLES.exp[255 - s_GF_TABLES.log[value]];
+}
+
+// dst[i] ^= c * src[i]. Coefficient 1, the whole of XOR parity, is a plain word-wide XOR.
+inline void GfMulAddPortable(uint8_t* dst, uint8_t const* src, uint8_t c, size_t len) noexcept
+{
+    size_t index = 0;
+    if (c == 1) {
+        for (; index + 8 <= len; index += 8) {
+            uint64_t lhs, rhs;
+            std::memcpy(&lhs, dst + index, sizeof(lhs));
+            std::memcpy(&rhs, src + index, sizeof(rhs));
+            lhs ^= rhs;
+            std::memcpy(dst + index, &lhs, sizeof(lhs));
+        }
+    }
+    uint8_t const* low  = s_GF_TABLES.low[c];
+    uint8_t const* high = s_GF_TABLES.high[c];
+    for (; index < len; ++index) {
+        dst[index] ^= low[src[index] & 0x0F] ^ high[src[index] >> 4];
+    }
+}
+
+#if defined(CN_HAVE_X86_GF)
+// Split-nibble multiply: each 16-entry product table fits one register, and pshufb looks up 16 or 32 bytes at once
+__attribute__((target("ssse3"))) inline void GfMulAddSsse3(uint8_t* dst, uint8_t const* src, uint8_t c, size_t len) noexcept
+{
+    __m128i low  = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s_GF_TABLES.low[c]));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s_GF_TABLES.high[c]));
+    __m128i mask = _mm_set1_epi8(0x0F);
+    size_t index = 0;
+    for (; index + 16 <= len; index += 16) {
+        __m128i in      = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + index));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(in, mask)),
+                                        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask)));
+        __m128i out     = _mm_loadu_si128(reinterpret_cast<__m128i const*>(dst + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + index), _mm_xor_si128(out, product));
+    }
+    GfMulAddPortable(dst + index, src + index, c, len - index);
+}
+
+__attribute__((target("avx2"))) inline void GfMulAddAvx2(uint8_t* dst, uint8_t const* src, uint8_t c, size_t len) noexcept
+{
+    __m256i low  = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(s_GF_TABLES.low[c])));
+    __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(s_GF_TABLES.high[c])));
+    __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t index = 0;
+    for (; index + 32 <= len; index += 32) {
+        __m256i in      = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + index));
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(in, mask)),
+                                           _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask)));
+        __m256i out     = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(dst + index));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + index), _mm256_xor_si256(out, product));
+    }
+    GfMulAddPortable(dst + index, src + index, c, len - index);
+}
+#endif
+
+using GfMulAddKernel = void (*)(uint8_t*, uint8_t const*, uint8_t, size_t) noexcept;
+
+inline GfMulAddKernel SelectGfMulAddKernel() noexcept
+{
+#if defined(CN_HAVE_X86_GF)
+    if (__builtin_cpu_supports("avx2")) {
+        return GfMulAddAvx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return GfMulAddSsse3;
+    }
+#endif
+    return GfMulAddPortable;
+}
+
+inline char const* GfKernelName() noexcept
+{
+#if defined(CN_HAVE_X86_GF)
+    if (SelectGfMulAddKernel() == GfMulAddAvx2) {
+        return "avx2";
+    }
+    if (SelectGfMulAddKernel() == GfMulAddSsse3) {
+        return "ssse3";
+    }
+#endif
+    return "portable";
+}
+
+inline void GfMulAdd(void* dst, void const* src, uint8_t c, size_t len) noexcept
+{
+    static GfMulAddKernel const kernel = SelectGfMulAddKernel();
+    if (c != 0) {
+        kernel(static_cast<uint8_t*>(dst), static_cast<uint8_t const*>(src), c, len);
+    }
+}
+
+inline uint8_t FecCoefficient(uint8_t block_size, uint8_t row, size_t column) noexcept
+{
+    uint8_t y = static_cast<uint8_t>(column);
+    return GfMul(block_size ^ y, GfInverse(static_cast<uint8_t>(block_size + row) ^ y));
+}
+
+// Writes repair `row` of a block to `out`, `len` bytes, from the k data packets data[j] of length lens[j] <= len
+inline void EncodeRepair(char* out, size_t len, uint8_t block_size, uint8_t row, char const* const* data, size_t const* lens, size_t k) noexcept
+{
+    std::memset(out, 0, len);
+    for (size_t column = 0; column < k; ++column) {
+        GfMulAdd(out, data[column], FecCoefficient(block_size, row, column), lens[column]);
+    }
+}
+
+// Rebuilds the data packets of a block named in `missing` from as many repairs. data[j] points at each packet's
+// storage and lens[j] is its length; packets not missing are read, missing ones are written. Fails when the
+// repairs are fewer than the losses or repeat a row.
+inline bool RecoverBlock(char* const* data, size_t const* lens, size_t k, std::vector<size_t> const& missing, uint8_t block_size,
+                         uint8_t const* rows, char const* const* repairs, size_t repair_count, size_t len) noexcept
+{
+    size_t erased = missing.size();
+    if (erased > repair_count) {
+        return false;
+    }
+    std::vector<bool> lost(k);
+    for (size_t column : missing) {
+        lost[column] = true;
+    }
+
+    // What the repairs say about the missing packets once the packets that did arrive are subtracted out
+    std::vector<char> syndromes(erased * len);
+    for (size_t equation = 0; equation < erased; ++equation) {
+        char* syndrome = syndromes.data() + equation * len;
+        std::memcpy(syndrome, repairs[equation], len);
+        for (size_t column = 0; column < k; ++column) {
+            if (!lost[column]) {
+                GfMulAdd(syndrome, data[column], FecCoefficient(block_size, rows[equation], column), lens[column]);
+            }
+        }
+    }
+
+    // Any square submatrix of a Cauchy matrix is invertible, so with distinct rows Gauss-Jordan always finds a pivot
+    std::vector<uint8_t> matrix(erased * erased);
+    std::vector<uint8_t> inverse(erased * erased);
+    for (size_t row = 0; row < erased; ++row) {
+        for (size_t column = 0; column < erased; ++column) {
+            matrix[row * erased + column] = FecCoefficient(block_size, rows[row], missing[column]);
+        }
+        inverse[row * erased + row] = 1;
+    }
+    for (size_t pivot = 0; pivot < erased; ++pivot) {
+        size_t row = pivot;
+        while (row < erased && matrix[row * erased + pivot] == 0) {
+            ++row;
+        }
+        if (row == erased) {
+            return false;   // repeated repair rows
+        }
+        for (size_t column = 0; column < erased; ++column) {
+            std::swap(matrix[row * erased + column], matrix[pivot * erased + column]);
+            std::swap(inverse[row * erased + column], inverse[pivot * erased + column]);
+        }
+        uint8_t scale = GfInverse(matrix[pivot * erased + pivot]);
+        for (size_t column = 0; column < erased; ++column) {
+            matrix[pivot * erased + column]  = GfMul(matrix[pivot * erased + column], scale);
+            inverse[pivot * erased + column] = GfMul(inverse[pivot * erased + column], scale);
+        }
+        for (size_t other = 0; other < erased; ++other) {
+            uint8_t factor = matrix[other * erased + pivot];
+            if (other == pivot || factor == 0) {
+                continue;
+            }
+            for (size_t column = 0; column < erased; ++column) {
+                matrix[other * erased + column] ^= GfMul(factor, matrix[pivot * erased + column]);
+                inverse[other * erased + column] ^= GfMul(factor, inverse[pivot * erased + column]);
+            }
+        }
+    }
+
+    std::vector<char> rebuilt(len);
+    for (size_t target = 0; target < erased; ++target) {
+        std::memset(rebuilt.data(), 0, len);
+        for (size_t equation = 0; equation < erased; ++equation) {
+            GfMulAdd(rebuilt.data(), syndromes.data() + equation * len, inverse[target * erased + equation], len);
+        }
+        std::memcpy(data[missing[target]], rebuilt.data(), lens[missing[target]]);
+    }
+    return true;
+}
+
+#endif
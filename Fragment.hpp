@@ -0,0 +1,370 @@
+#ifndef FRAGMENT
+#define FRAGMENT
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include "Fec.hpp"
+
+// A UDP message is carried as `count` datagrams, each a fixed header followed by its slice of the message.
+// Every fragment but the last holds exactly s_FRAGMENT_PAYLOAD bytes, so the index alone places it.
+//
+//   0         1        2         4         6            7            8            12             16
+//   | version | flags  | index   | count   | block size | repair row | message id | total length | payload ...
+//
+// Multi-byte fields are big-endian. With forward error correction the fragments are grouped by index into
+// blocks of `block size`, and each block is followed by repair datagrams flagged s_FRAGMENT_REPAIR whose index
+// is the block's first fragment and whose payload is as long as that fragment (see Fec.hpp). Block size 0 means
+// the message carries no repairs.
+
+struct FragmentHeader {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t index;
+    uint16_t count;
+    uint8_t block_size;
+    uint8_t repair_row;
+    uint32_t message_id;
+    uint32_t total_length;
+};
+
+constexpr uint8_t s_FRAGMENT_VERSION { 1 };
+constexpr size_t s_FRAGMENT_HEADER_SIZE { 16 };
+constexpr size_t s_MAX_DATAGRAM { 1472 };   // 1500-byte Ethernet MTU less the IPv4 and UDP headers
+constexpr size_t s_FRAGMENT_PAYLOAD { s_MAX_DATAGRAM - s_FRAGMENT_HEADER_SIZE };
+constexpr size_t s_MAX_FRAGMENTS { 65535 };
+constexpr uint8_t s_FRAGMENT_REPAIR { 0x01 };
+
+inline uint16_t FragmentCount(size_t total_length) noexcept
+{
+    return static_cast<uint16_t>(std::max<size_t>(1, (total_length + s_FRAGMENT_PAYLOAD - 1) / s_FRAGMENT_PAYLOAD));
+}
+
+// Payload length of fragment `index`; only the last fragment of a message is short
+inline size_t FragmentLength(size_t total_length, size_t index) noexcept
+{
+    size_t offset = index * s_FRAGMENT_PAYLOAD;
+    return std::min(s_FRAGMENT_PAYLOAD, total_length - std::min(offset, total_length));
+}
+
+inline void EncodeFragmentHeader(char* out, uint32_t message_id, uint16_t index, uint16_t count, uint32_t total_length, uint8_t block_size = 0) noexcept
+{
+    index        = htons(index);
+    count        = htons(count);
+    message_id   = htonl(message_id);
+    total_length = htonl(total_length);
+    out[0]       = static_cast<char>(s_FRAGMENT_VERSION);
+    out[1]       = 0;
+    std::memcpy(out + 2, &index, sizeof(index));
+    std::memcpy(out + 4, &count, sizeof(count));
+    out[6] = static_cast<char>(block_size);
+    out[7] = 0;
+    std::memcpy(out + 8, &message_id, sizeof(message_id));
+    std::memcpy(out + 12, &total_length, sizeof(total_length));
+}
+
+// Repair `row` of the block starting at fragment `first`
+inline void EncodeRepairHeader(char* out, uint32_t message_id, uint16_t first, uint16_t count, uint32_t total_length, uint8_t block_size,
+                               uint8_t row) noexcept
+{
+    EncodeFragmentHeader(out, message_id, first, count, total_length, block_size);
+    out[1] = static_cast<char>(s_FRAGMENT_REPAIR);
+    out[7] = static_cast<char>(row);
+}
+
+// False when the datagram is not a well-formed fragment: wrong version, index out of range,
+// or a payload length that does not match its position in the message. A repair must also start a block
+// and use a row the code has.
+inline bool DecodeFragmentHeader(char const* in, size_t len, FragmentHeader& header) noexcept
+{
+    if (len < s_FRAGMENT_HEADER_SIZE) {
+        return false;
+    }
+    header.version = static_cast<uint8_t>(in[0]);
+    header.flags   = static_cast<uint8_t>(in[1]);
+    std::memcpy(&header.index, in + 2, sizeof(header.index));
+    std::memcpy(&header.count, in + 4, sizeof(header.count));
+    header.block_size = static_cast<uint8_t>(in[6]);
+    header.repair_row = static_cast<uint8_t>(in[7]);
+    std::memcpy(&header.message_id, in + 8, sizeof(header.message_id));
+    std::memcpy(&header.total_length, in + 12, sizeof(header.total_length));
+    header.index        = ntohs(header.index);
+    header.count        = ntohs(header.count);
+    header.message_id   = ntohl(header.message_id);
+    header.total_length = ntohl(header.total_length);
+
+    bool repair = header.flags & s_FRAGMENT_REPAIR;
+    if (repair && (header.block_size == 0 || header.index % header.block_size != 0 || header.block_size + header.repair_row > 255)) {
+        return false;
+    }
+    return header.version == s_FRAGMENT_VERSION && header.index < header.count && header.count == FragmentCount(header.total_length)
+        && len - s_FRAGMENT_HEADER_SIZE == FragmentLength(header.total_length, header.index);
+}
+
+// Collects fragments per (peer, message id) and hands back a message only once every fragment is in.
+// Partial messages are dropped after `timeout`, and the oldest ones are evicted whenever the buffered
+// bytes, repairs included, would exceed `memory_cap`. Repairs wait with their message until their block has as many packets
+// as data fragments, then rebuild whatever is missing without a round trip. Messages sent with repairs
+// are remembered for `timeout` after they complete, so the repairs trailing them are not mistaken for
+// the start of a new message.
+class Reassembler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        size_t completed {};
+        size_t duplicates {};
+        size_t expired {};
+        size_t evicted {};
+        size_t rejected {};         // messages larger than the whole memory cap
+        size_t repairs {};          // repair datagrams received
+        size_t recovered {};        // data fragments rebuilt from repairs
+        size_t unused_repairs {};   // repairs for blocks that were already whole or that did not fit under the cap
+    };
+
+    Reassembler(size_t memory_cap, std::chrono::milliseconds timeout) noexcept
+        : m_memory_cap { memory_cap }
+        , m_timeout { timeout }
+    {
+    }
+
+    // Returns true and moves the message into `message` when this fragment completes it
+    bool offer(uint64_t peer, FragmentHeader const& header, char const* payload, Clock::time_point now, std::vector<char>& message) noexcept
+    {
+        Key key { peer, header.message_id };
+        bool repair = header.flags & s_FRAGMENT_REPAIR;
+        m_stats.repairs += repair;
+        if (header.block_size != 0 && m_finished.count(key) != 0) {
+            ++(repair ? m_stats.unused_repairs : m_stats.duplicates);
+            return false;
+        }
+
+        auto it = m_partial.find(key);
+        if (it == m_partial.end()) {
+            if (header.count == 1 && !repair) {
+                message.assign(payload, payload + header.total_length);
+                m_complete(key, header.block_size, now);
+                return true;
+            }
+            if (header.total_length > m_memory_cap) {
+                ++m_stats.rejected;
+                return false;
+            }
+            while (m_bytes + header.total_length > m_memory_cap) {
+                m_evict_oldest(key);
+            }
+            Entry entry { std::vector<char>(header.total_length), std::vector<bool>(header.count), {}, now + m_timeout, header.block_size, {}, {} };
+            it = m_partial.emplace(key, std::move(entry)).first;
+            m_bytes += header.total_length;
+        }
+
+        Entry& entry = it->second;
+        if (entry.data.size() != header.total_length || entry.have.size() != header.count || entry.block_size != header.block_size) {
+            ++m_stats.duplicates;   // reused id with a different shape, keep the first message
+            return false;
+        }
+        size_t first = header.index;
+        if (repair) {
+            if (!m_add_repair(key, entry, header, payload)) {
+                return false;
+            }
+        } else if (entry.have[header.index]) {
+            ++m_stats.duplicates;
+            return false;
+        } else {
+            size_t offset = static_cast<size_t>(header.index) * s_FRAGMENT_PAYLOAD;
+            std::memcpy(entry.data.data() + offset, payload, FragmentLength(entry.data.size(), header.index));
+            entry.have[header.index] = true;
+            ++entry.received;
+            first -= entry.block_size != 0 ? header.index % entry.block_size : 0;
+        }
+        if (!entry.repairs.empty()) {
+            m_try_recover(entry, first);
+        }
+        if (entry.received < header.count) {
+            return false;
+        }
+        message = std::move(entry.data);
+        m_bytes -= header.total_length + entry.repair_bytes;
+        m_partial.erase(it);
+        m_complete(key, header.block_size, now);
+        return true;
+    }
+
+    void expire(Clock::time_point now) noexcept
+    {
+        for (auto it = m_partial.begin(); it != m_partial.end();) {
+            if (it->second.deadline <= now) {
+                m_bytes -= it->second.data.size() + it->second.repair_bytes;
+                it = m_partial.erase(it);
+                ++m_stats.expired;
+            } else {
+                ++it;
+            }
+        }
+        while (!m_finished_order.empty() && m_finished_order.front().first <= now) {
+            m_finished.erase(m_finished_order.front().second);
+            m_finished_order.pop_front();
+        }
+    }
+
+    size_t pending() const noexcept { return m_partial.size(); }
+    size_t buffered_bytes() const noexcept { return m_bytes; }
+    Stats const& stats() const noexcept { return m_stats; }
+
+private:
+    using Key = std::pair<uint64_t, uint32_t>;
+
+    static constexpr size_t s_MAX_FINISHED { 65536 };
+
+    struct KeyHash {
+        size_t operator()(Key const& key) const noexcept
+        {
+            return std::hash<uint64_t> {}(key.first * 0x9E3779B97F4A7C15ULL ^ key.second);
+        }
+    };
+
+    struct Repair {
+        uint16_t first;
+        uint8_t row;
+        std::vector<char> payload;
+    };
+
+    struct Entry {
+        std::vector<char> data;
+        std::vector<bool> have;
+        uint16_t received;
+        Clock::time_point deadline;
+        uint8_t block_size;
+        size_t repair_bytes;
+        std::vector<Repair> repairs;   // only for blocks still missing data
+    };
+
+    void m_complete(Key const& key, uint8_t block_size, Clock::time_point now) noexcept
+    {
+        ++m_stats.completed;
+        if (block_size == 0) {
+            return;
+        }
+        if (m_finished_order.size() == s_MAX_FINISHED) {
+            m_finished.erase(m_finished_order.front().second);
+            m_finished_order.pop_front();
+        }
+        m_finished.insert(key);
+        m_finished_order.emplace_back(now + m_timeout, key);
+    }
+
+    size_t m_block_length(Entry const& entry, size_t first) const noexcept
+    {
+        return std::min<size_t>(entry.block_size, entry.have.size() - first);
+    }
+
+    bool m_add_repair(Key const& key, Entry& entry, FragmentHeader const& header, char const* payload) noexcept
+    {
+        size_t present = std::count(entry.have.begin() + header.index, entry.have.begin() + header.index + m_block_length(entry, header.index), true);
+        bool repeated  = std::any_of(entry.repairs.begin(), entry.repairs.end(), [&](Repair const& repair) {
+            return repair.first == header.index && repair.row == header.repair_row;
+        });
+        if (present == m_block_length(entry, header.index) || repeated) {
+            ++m_stats.unused_repairs;
+            return false;
+        }
+        // Repairs count against the cap like data; other messages make room first, and a repair that would not
+        // fit beside its own message is dropped
+        size_t len = FragmentLength(entry.data.size(), header.index);
+        while (m_bytes + len > m_memory_cap && m_partial.size() > 1) {
+            m_evict_oldest(key);
+        }
+        if (m_bytes + len > m_memory_cap) {
+            ++m_stats.unused_repairs;
+            return false;
+        }
+        entry.repairs.push_back({ header.index, header.repair_row, std::vector<char>(payload, payload + len) });
+        entry.repair_bytes += len;
+        m_bytes += len;
+        return true;
+    }
+
+    // Rebuilds the block starting at `first` once its data and repairs together are enough, and lets go of the
+    // block's repairs once it is whole
+    void m_try_recover(Entry& entry, size_t first) noexcept
+    {
+        size_t k = m_block_length(entry, first);
+        std::vector<uint8_t> rows;
+        std::vector<char const*> repairs;
+        for (Repair const& repair : entry.repairs) {
+            if (repair.first == first) {
+                rows.push_back(repair.row);
+                repairs.push_back(repair.payload.data());
+            }
+        }
+        if (repairs.empty()) {
+            return;
+        }
+
+        std::vector<size_t> missing;
+        std::vector<char*> data(k);
+        std::vector<size_t> lens(k);
+        for (size_t column = 0; column < k; ++column) {
+            data[column] = entry.data.data() + (first + column) * s_FRAGMENT_PAYLOAD;
+            lens[column] = FragmentLength(entry.data.size(), first + column);
+            if (!entry.have[first + column]) {
+                missing.push_back(column);
+            }
+        }
+        if (missing.size() > repairs.size()) {
+            return;
+        }
+        if (!missing.empty()) {
+            if (!RecoverBlock(data.data(), lens.data(), k, missing, entry.block_size, rows.data(), repairs.data(), missing.size(), lens[0])) {
+                return;
+            }
+            for (size_t column : missing) {
+                entry.have[first + column] = true;
+            }
+            entry.received += missing.size();
+            m_stats.recovered += missing.size();
+        }
+        m_stats.unused_repairs += repairs.size() - missing.size();
+        for (auto it = entry.repairs.begin(); it != entry.repairs.end();) {
+            if (it->first == first) {
+                entry.repair_bytes -= it->payload.size();
+                m_bytes -= it->payload.size();
+                it = entry.repairs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Every entry shares one timeout, so the earliest deadline is also the oldest message. `keep`, the message
+    // being added to, is never chosen while another one is left.
+    void m_evict_oldest(Key const& keep) noexcept
+    {
+        auto oldest = std::min_element(m_partial.begin(), m_partial.end(), [&](auto const& lhs, auto const& rhs) {
+            return lhs.first != keep && (rhs.first == keep || lhs.second.deadline < rhs.second.deadline);
+        });
+        m_bytes -= oldest->second.data.size() + oldest->second.repair_bytes;
+        m_partial.erase(oldest);
+        ++m_stats.evicted;
+    }
+
+    size_t const m_memory_cap;
+    std::chrono::milliseconds const m_timeout;
+    std::unordered_map<Key, Entry, KeyHash> m_partial;
+    std::unordered_set<Key, KeyHash> m_finished;
+    std::deque<std::pair<Clock::time_point, Key>> m_finished_order;
+    size_t m_bytes {};
+    Stats m_stats;
+};
+
+#endif
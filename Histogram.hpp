@@ -0,0 +1,92 @@
+#ifndef HISTOGRAM
+#define HISTOGRAM
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below s_SUB_BUCKETS are counted exactly;
+// above that every power of two is split into s_SUB_BUCKETS / 2 linear buckets, so any recorded value is
+// reported within 1/64 (about 1.6%) of itself. Fixed size, no allocation, and record() is a handful of
+// instructions, so it can sit on a measured path.
+class Histogram {
+public:
+    void record(uint64_t value) noexcept
+    {
+        ++m_counts[s_index(value)];
+        ++m_total;
+        m_sum += value;
+        m_min = std::min(m_min, value);
+        m_max = std::max(m_max, value);
+    }
+
+    void merge(Histogram const& other) noexcept
+    {
+        for (size_t index {}; index < s_BUCKETS; ++index) {
+            m_counts[index] += other.m_counts[index];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    // Smallest bucket value with at least `quantile` of the samples at or below it (quantile in [0, 1])
+    uint64_t percentile(double quantile) const noexcept
+    {
+        if (m_total == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * m_total + 0.5));
+        uint64_t seen = 0;
+        for (size_t index {}; index < s_BUCKETS; ++index) {
+            seen += m_counts[index];
+            if (seen >= rank) {
+                return std::clamp(s_value(index), m_min, m_max);
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const noexcept { return m_total; }
+    uint64_t min() const noexcept { return m_total ? m_min : 0; }
+    uint64_t max() const noexcept { return m_max; }
+    double mean() const noexcept { return m_total ? static_cast<double>(m_sum) / m_total : 0; }
+
+private:
+    static constexpr unsigned s_SUB_BITS { 7 };
+    static constexpr uint64_t s_SUB_BUCKETS { uint64_t { 1 } << s_SUB_BITS };
+    static constexpr uint64_t s_HALF { s_SUB_BUCKETS / 2 };
+    static constexpr size_t s_BUCKETS { s_SUB_BUCKETS + (64 - s_SUB_BITS) * s_HALF };
+
+    static size_t s_index(uint64_t value) noexcept
+    {
+        if (value < s_SUB_BUCKETS) {
+            return value;
+        }
+        unsigned msb   = 63 - __builtin_clzll(value);
+        unsigned shift = msb - (s_SUB_BITS - 1);
+        return s_SUB_BUCKETS + (msb - s_SUB_BITS) * s_HALF + ((value >> shift) - s_HALF);
+    }
+
+    // Midpoint of the bucket
+    static uint64_t s_value(size_t index) noexcept
+    {
+        if (index < s_SUB_BUCKETS) {
+            return index;
+        }
+        size_t octave  = (index - s_SUB_BUCKETS) / s_HALF;
+        uint64_t sub   = (index - s_SUB_BUCKETS) % s_HALF + s_HALF;
+        unsigned shift = static_cast<unsigned>(octave) + 1;
+        return (sub << shift) + (uint64_t { 1 } << shift) / 2;
+    }
+
+    std::array<uint64_t, s_BUCKETS> m_counts {};
+    uint64_t m_total {};
+    uint64_t m_sum {};
+    uint64_t m_min { UINT64_MAX };
+    uint64_t m_max {};
+};
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef LINK_EMULATOR
+#define LINK_EMULATOR
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+// Impairments applied to every message written through a LinkEmulator. Parsed from a comma separated
+// spec such as "latency=20,jitter=5,rate=8000,loss=0.01,dup=0.001,reorder=0.02,corrupt=0.01,seed=7".
+struct LinkConfig {
+    double latency_ms {};
+    double jitter_ms {};
+    double rate_kbps {};   // 0 means unlimited
+    double loss {};
+    double duplicate {};
+    double reorder {};
+    double corrupt {};   // flips one random bit of the message
+    uint64_t seed { 1 };
+};
+
+inline bool ParseLinkConfig(char const* spec, LinkConfig& config) noexcept
+{
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), "%s", spec);
+    for (char* item = std::strtok(buffer, ","); item != nullptr; item = std::strtok(nullptr, ",")) {
+        char* value = std::strchr(item, '=');
+        if (value == nullptr) {
+            return false;
+        }
+        *value++ = '\0';
+        if (std::strcmp(item, "latency") == 0) {
+            config.latency_ms = std::atof(value);
+        } else if (std::strcmp(item, "jitter") == 0) {
+            config.jitter_ms = std::atof(value);
+        } else if (std::strcmp(item, "rate") == 0) {
+            config.rate_kbps = std::atof(value);
+        } else if (std::strcmp(item, "loss") == 0) {
+            config.loss = std::atof(value);
+        } else if (std::strcmp(item, "dup") == 0) {
+            config.duplicate = std::atof(value);
+        } else if (std::strcmp(item, "reorder") == 0) {
+            config.reorder = std::atof(value);
+        } else if (std::strcmp(item, "corrupt") == 0) {
+            config.corrupt = std::atof(value);
+        } else if (std::strcmp(item, "seed") == 0) {
+            config.seed = std::strtoull(value, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Removes a trailing "--link <spec>" pair from argv so each program keeps its positional arguments
+inline LinkConfig ExtractLinkConfig(int& argc, char** argv) noexcept
+{
+    LinkConfig config;
+    for (int arg = 1; arg + 1 < argc; ++arg) {
+        if (std::strcmp(argv[arg], "--link") != 0) {
+            continue;
+        }
+        if (!ParseLinkConfig(argv[arg + 1], config)) {
+            std::fprintf(stderr, "Invalid link spec %s\n", argv[arg + 1]);
+            std::exit(EXIT_FAILURE);
+        }
+        for (int rest = arg; rest + 2 < argc; ++rest) {
+            argv[rest] = argv[rest + 2];
+        }
+        argc -= 2;
+        break;
+    }
+    return config;
+}
+
+// True when the spec impairs nothing, so callers may write to the socket directly
+inline bool IsIdealLink(LinkConfig const& config) noexcept
+{
+    return config.latency_ms == 0 && config.jitter_ms == 0 && config.rate_kbps == 0 && config.loss == 0
+        && config.duplicate == 0 && config.reorder == 0 && config.corrupt == 0;
+}
+
+// Emulates one direction of a link in-process. Every send() draws its fate from a seeded generator, so
+// a given seed and message sequence always sees the same losses, duplicates and delays. Surviving copies
+// are written to the socket by a delivery thread at their scheduled time, whole, so fixed-size or
+// self-delimiting frames stay intact on a byte stream.
+class LinkEmulator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        uint64_t sent {};
+        uint64_t dropped {};
+        uint64_t duplicated {};
+        uint64_t reordered {};
+        uint64_t corrupted {};
+    };
+
+    // `direction` decorrelates the two ends of a link that were given the same seed
+    LinkEmulator(int fd, LinkConfig const& config, uint64_t direction) noexcept
+        : m_fd { fd }
+        , m_config { config }
+        , m_rng { config.seed * 0x9E3779B97F4A7C15ULL + direction }
+        , m_link_free_at { Clock::now() }
+        , m_thread { [this] { m_deliver(); } }
+    {
+    }
+
+    LinkEmulator(LinkEmulator const&)            = delete;
+    LinkEmulator& operator=(LinkEmulator const&) = delete;
+
+    // Delivers everything still in flight before returning
+    ~LinkEmulator() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock { m_mutex };
+            m_closing = true;
+        }
+        m_wakeup.notify_one();
+        m_thread.join();
+    }
+
+    bool send(char const* data, size_t len) noexcept
+    {
+        std::unique_lock<std::mutex> lock { m_mutex };
+        if (m_failed) {
+            return false;
+        }
+        ++m_stats.sent;
+        if (m_chance(m_config.loss)) {
+            ++m_stats.dropped;
+            return true;
+        }
+
+        // Serialisation at the configured rate, then propagation with symmetric jitter
+        Clock::time_point now = Clock::now();
+        m_link_free_at        = std::max(m_link_free_at, now);
+        if (m_config.rate_kbps > 0) {
+            m_link_free_at += s_ms(len * 8 / m_config.rate_kbps);
+        }
+        double delay_ms = m_config.latency_ms + m_config.jitter_ms * (2 * m_uniform(m_rng) - 1);
+        if (m_chance(m_config.reorder)) {
+            delay_ms += m_config.latency_ms + m_config.jitter_ms + 1;   // held back long enough for later frames to pass it
+            ++m_stats.reordered;
+        }
+        Clock::time_point due = m_link_free_at + s_ms(std::max(0.0, delay_ms));
+        std::vector<char> bytes(data, data + len);
+        if (len > 0 && m_chance(m_config.corrupt)) {
+            size_t bit = static_cast<size_t>(m_uniform(m_rng) * len * 8);
+            bytes[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+            ++m_stats.corrupted;
+        }
+        if (m_chance(m_config.duplicate)) {
+            m_schedule(due + s_ms(m_config.jitter_ms * m_uniform(m_rng)), bytes);
+            ++m_stats.duplicated;
+        }
+        m_schedule(due, std::move(bytes));
+        lock.unlock();
+        m_wakeup.notify_one();
+        return true;
+    }
+
+    Stats stats() const noexcept
+    {
+        std::lock_guard<std::mutex> lock { m_mutex };
+        return m_stats;
+    }
+
+    // When the last message sent so far is due on the socket, so an owner can wait for it without blocking
+    Clock::time_point idle_at() const noexcept
+    {
+        std::lock_guard<std::mutex> lock { m_mutex };
+        return m_failed ? Clock::time_point {} : m_last_due;
+    }
+
+private:
+    struct Message {
+        Clock::time_point due;
+        uint64_t order;   // keeps equal deadlines in send order
+        std::vector<char> bytes;
+
+        bool operator>(Message const& other) const noexcept
+        {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    static Clock::duration s_ms(double ms) noexcept
+    {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+    }
+
+    bool m_chance(double probability) noexcept
+    {
+        return probability > 0 && m_uniform(m_rng) < probability;
+    }
+
+    void m_schedule(Clock::time_point due, std::vector<char> bytes) noexcept
+    {
+        m_last_due = std::max(m_last_due, due);
+        m_queue.push({ due, m_order++, std::move(bytes) });
+    }
+
+    void m_deliver() noexcept
+    {
+        std::unique_lock<std::mutex> lock { m_mutex };
+        for (;;) {
+            if (m_queue.empty()) {
+                if (m_closing) {
+                    return;
+                }
+                m_wakeup.wait(lock);
+                continue;
+            }
+            if (m_queue.top().due > Clock::now()) {
+                m_wakeup.wait_until(lock, m_queue.top().due);
+                continue;
+            }
+            Message message = std::move(const_cast<Message&>(m_queue.top()));
+            m_queue.pop();
+            lock.unlock();
+            bool written = s_write_all(m_fd, message.bytes.data(), message.bytes.size());
+            lock.lock();
+            if (!written) {
+                m_failed = true;
+                m_queue  = {};
+            }
+        }
+    }
+
+    // The delivery thread may block, so a non-blocking socket is waited on here rather than given up on
+    static bool s_write_all(int fd, char const* data, size_t len) noexcept
+    {
+        while (len > 0) {
+            ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pollfd writable { fd, POLLOUT, 0 };
+                ::poll(&writable, 1, -1);
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    int const m_fd;
+    LinkConfig const m_config;
+    std::mt19937_64 m_rng;
+    std::uniform_real_distribution<double> m_uniform { 0.0, 1.0 };
+    Clock::time_point m_link_free_at;
+    uint64_t m_order {};
+    Clock::time_point m_last_due {};
+    std::priority_queue<Message, std::vector<Message>, std::greater<Message>> m_queue;
+    Stats m_stats;
+    bool m_closing {};
+    bool m_failed {};
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef LOCK_FREE_QUEUE
+#define LOCK_FREE_QUEUE
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded multi-producer multi-consumer ring (Vyukov). Each cell carries a sequence number
+// so producers and consumers only contend on their own cursor.
+template <typename T>
+class LockFreeQueue {
+public:
+    explicit LockFreeQueue(size_t capacity) noexcept
+        : m_mask { s_round_up(capacity) - 1 }
+        , m_cells { new Cell[m_mask + 1] }
+    {
+        for (size_t i {}; i <= m_mask; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    LockFreeQueue(LockFreeQueue const&)            = delete;
+    LockFreeQueue& operator=(LockFreeQueue const&) = delete;
+
+    bool push(T&& value) noexcept
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell         = &m_cells[pos & m_mask];
+            intptr_t dif = static_cast<intptr_t>(cell->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;   // full
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) noexcept
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell         = &m_cells[pos & m_mask];
+            intptr_t dif = static_cast<intptr_t>(cell->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;   // empty
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    static size_t s_round_up(size_t capacity) noexcept
+    {
+        size_t size { 2 };
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    size_t const m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    alignas(64) std::atomic<size_t> m_tail {};
+    alignas(64) std::atomic<size_t> m_head {};
+};
+
+#endif
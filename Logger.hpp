@@ -1,12 +1,251 @@
 #ifndef LOGGER
 #define LOGGER
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <initializer_list>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define CN_LOG_LEVEL_DEBUG 0
+#define CN_LOG_LEVEL_INFO  1
+#define CN_LOG_LEVEL_WARN  2
+#define CN_LOG_LEVEL_ERROR 3
+#define CN_LOG_LEVEL_NONE  4
+
+// Calls below this level compile to nothing; their arguments are type-checked but never evaluated
+#ifndef CN_LOG_LEVEL
+#define CN_LOG_LEVEL CN_LOG_LEVEL_INFO
+#endif
+
+#ifndef CN_LOG_RING_BYTES
+#define CN_LOG_RING_BYTES (8UL << 20)
+#endif
+
+// Producers reserve space in a byte ring with one CAS, copy their record in and publish its header; they never
+// lock or make a syscall. One writer thread drains published records in order and hands each run of records
+// for the same stream to writev. A record that does not fit is dropped and counted, so a slow terminal or
+// pipe costs log lines instead of stalling the caller.
+class AsyncLog {
+public:
+    enum Stream : uint64_t {
+        OUT = 0,
+        ERR = 1,
+    };
+
+    struct Piece {
+        char const* data;
+        size_t len;
+    };
+
+    static AsyncLog& instance() noexcept
+    {
+        static AsyncLog log;
+        return log;
+    }
+
+    AsyncLog(AsyncLog const&)            = delete;
+    AsyncLog& operator=(AsyncLog const&) = delete;
+
+    // Writes everything still queued before returning
+    ~AsyncLog() noexcept
+    {
+        m_closing.store(true, std::memory_order_release);
+        m_wakeup.notify_one();
+        m_thread.join();
+        size_t dropped   = m_dropped.load(std::memory_order_relaxed);
+        size_t truncated = m_truncated.load(std::memory_order_relaxed);
+        if (dropped != 0 || truncated != 0) {
+            std::fprintf(stderr, "Logger dropped %zu records and truncated %zu\n", dropped, truncated);
+            std::fflush(stderr);
+        }
+    }
+
+    // Queues the concatenation of `pieces` as one record. Returns false if it was dropped.
+    bool write(Stream stream, std::initializer_list<Piece> pieces) noexcept
+    {
+        size_t len = 0;
+        for (Piece const& piece : pieces) {
+            len += piece.len;
+        }
+        if (len > s_MAX_RECORD) {
+            m_truncated.fetch_add(1, std::memory_order_relaxed);
+            len = s_MAX_RECORD;
+        }
+
+        size_t need = s_HEADER_SIZE + s_align(len);
+        size_t pos  = m_reserved.load(std::memory_order_relaxed);
+        do {
+            if (pos + need - m_released.load(std::memory_order_acquire) > s_CAPACITY) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!m_reserved.compare_exchange_weak(pos, pos + need, std::memory_order_relaxed));
+
+        size_t offset = pos + s_HEADER_SIZE;
+        size_t left   = len;
+        for (Piece const& piece : pieces) {
+            size_t part = std::min(piece.len, left);
+            m_copy_in(offset, piece.data, part);
+            offset += part;
+            left -= part;
+        }
+        __atomic_store_n(m_header(pos), s_READY | static_cast<uint64_t>(stream) << 32 | len, __ATOMIC_RELEASE);
+
+        // Pairs with the fence in m_run so either the writer sees this record or we see it idle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle.load(std::memory_order_relaxed)) {
+            m_wakeup.notify_one();
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t s_CAPACITY { CN_LOG_RING_BYTES };
+    static constexpr size_t s_MAX_RECORD { s_CAPACITY / 2 };
+    static constexpr size_t s_HEADER_SIZE { sizeof(uint64_t) };
+    static constexpr uint64_t s_READY { uint64_t { 1 } << 63 };
+    static constexpr int s_MAX_IOV { 64 };
+    static constexpr std::chrono::milliseconds s_IDLE_WAIT { 10 };   // bounds the delay of a wakeup lost to a race
+
+    static_assert((s_CAPACITY & (s_CAPACITY - 1)) == 0 && s_CAPACITY >= 64, "CN_LOG_RING_BYTES must be a power of two");
+
+    AsyncLog() noexcept
+        : m_words { new uint64_t[s_CAPACITY / sizeof(uint64_t)]() }
+        , m_ring { reinterpret_cast<char*>(m_words.get()) }
+        , m_thread { [this] { m_run(); } }
+    {
+    }
+
+    // Records start 8-byte aligned, so a header never straddles the end of the ring
+    static size_t s_align(size_t len) noexcept
+    {
+        return (len + s_HEADER_SIZE - 1) & ~(s_HEADER_SIZE - 1);
+    }
+
+    uint64_t* m_header(size_t pos) const noexcept
+    {
+        return reinterpret_cast<uint64_t*>(m_ring + (pos & (s_CAPACITY - 1)));
+    }
+
+    void m_copy_in(size_t pos, char const* data, size_t len) noexcept
+    {
+        size_t at    = pos & (s_CAPACITY - 1);
+        size_t first = std::min(len, s_CAPACITY - at);
+        std::memcpy(m_ring + at, data, first);
+        std::memcpy(m_ring, data + first, len - first);
+    }
+
+    void m_run() noexcept
+    {
+        for (;;) {
+            if (m_flush()) {
+                continue;
+            }
+            if (m_closing.load(std::memory_order_acquire)) {
+                while (m_flush()) {
+                }
+                return;
+            }
+            std::unique_lock<std::mutex> lock { m_mutex };
+            m_idle.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!(__atomic_load_n(m_header(m_read), __ATOMIC_ACQUIRE) & s_READY)) {
+                m_wakeup.wait_for(lock, s_IDLE_WAIT);
+            }
+            m_idle.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Writes the next run of published records that share a stream, then hands their space back zeroed so
+    // a stale header can never look published. Returns false if nothing was ready.
+    bool m_flush() noexcept
+    {
+        iovec iov[s_MAX_IOV];
+        int count     = 0;
+        uint64_t kind = 0;
+        size_t pos    = m_read;
+        for (;;) {
+            uint64_t header = __atomic_load_n(m_header(pos), __ATOMIC_ACQUIRE);
+            uint64_t stream = header >> 32 & 1;
+            if (!(header & s_READY) || (count > 0 && stream != kind) || count + 2 > s_MAX_IOV) {
+                break;
+            }
+            kind         = stream;
+            size_t len   = header & 0xFFFFFFFF;
+            size_t at    = (pos + s_HEADER_SIZE) & (s_CAPACITY - 1);
+            size_t end   = std::min(len, s_CAPACITY - at);
+            iov[count++] = { m_ring + at, end };
+            if (end < len) {
+                iov[count++] = { m_ring, len - end };
+            }
+            pos += s_HEADER_SIZE + s_align(len);
+        }
+        if (pos == m_read) {
+            return false;
+        }
+
+        s_write_all(kind == ERR ? STDERR_FILENO : STDOUT_FILENO, iov, count);
+        size_t at    = m_read & (s_CAPACITY - 1);
+        size_t first = std::min(pos - m_read, s_CAPACITY - at);
+        std::memset(m_ring + at, 0, first);
+        std::memset(m_ring, 0, pos - m_read - first);
+        m_read = pos;
+        m_released.store(pos, std::memory_order_release);
+        return true;
+    }
+
+    // A closed or failing descriptor loses the rest of the run rather than wedging the writer
+    static void s_write_all(int fd, iovec* iov, int count) noexcept
+    {
+        while (count > 0) {
+            ssize_t n = ::writev(fd, iov, count);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            for (; count > 0 && static_cast<size_t>(n) >= iov->iov_len; ++iov, --count) {
+                n -= iov->iov_len;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+    }
+
+    std::unique_ptr<uint64_t[]> m_words;
+    char* const m_ring;
+    size_t m_read {};   // writer thread only
+    alignas(64) std::atomic<size_t> m_reserved {};
+    alignas(64) std::atomic<size_t> m_released {};
+    alignas(64) std::atomic<size_t> m_dropped {};
+    std::atomic<size_t> m_truncated {};
+    std::atomic<bool> m_idle {};
+    std::atomic<bool> m_closing {};
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
+};
 
 void LogToStdOut(char const* message, size_t size, char const* delim = "\n")
 {
-    std::cout.write(message, size) << delim << std::ends;
+    AsyncLog::instance().write(AsyncLog::OUT, { { message, size }, { delim, std::strlen(delim) } });
 }
 
 int32_t LogFromStdIn(char* message_ptr, size_t size)
@@ -16,17 +255,43 @@ int32_t LogFromStdIn(char* message_ptr, size_t size)
 
 void LogToStdOut(std::string const& message, char const* delim = "\n")
 {
-    std::cout << message << delim << std::ends;
+    LogToStdOut(message.data(), message.size(), delim);
 }
 
 void LogToStdErr(std::string const& message)
 {
-    std::cerr << message << std::endl;
+    AsyncLog::instance().write(AsyncLog::ERR, { { message.data(), message.size() }, { "\n", 1 } });
 }
 
+// exit() runs the logger's destructor, so everything queued before the message is still written
 void LogToStdErrAndTerminate(std::string const& message)
 {
     LogToStdErr(message);
     std::exit(-1);
 }
-#endif
\ No newline at end of file
+
+#if CN_LOG_LEVEL <= CN_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LogToStdOut(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)sizeof(LogToStdOut(__VA_ARGS__), 0))
+#endif
+
+#if CN_LOG_LEVEL <= CN_LOG_LEVEL_INFO
+#define LOG_INFO(...) LogToStdOut(__VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)sizeof(LogToStdOut(__VA_ARGS__), 0))
+#endif
+
+#if CN_LOG_LEVEL <= CN_LOG_LEVEL_WARN
+#define LOG_WARN(...) LogToStdErr(__VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)sizeof(LogToStdErr(__VA_ARGS__), 0))
+#endif
+
+#if CN_LOG_LEVEL <= CN_LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LogToStdErr(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)sizeof(LogToStdErr(__VA_ARGS__), 0))
+#endif
+
+#endif
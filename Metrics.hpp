@@ -0,0 +1,134 @@
+#ifndef METRICS
+#define METRICS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Counter with exactly one writing thread. The owner bumps it with a plain load and store instead of a locked
+// read-modify-write, so counting costs the same as a non-atomic increment; any thread may read it.
+class Counter {
+public:
+    void add(uint64_t amount = 1) noexcept { m_value.store(m_value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed); }
+    void sub(uint64_t amount) noexcept { m_value.store(m_value.load(std::memory_order_relaxed) - amount, std::memory_order_relaxed); }
+    void set(uint64_t value) noexcept { m_value.store(value, std::memory_order_relaxed); }
+    uint64_t load() const noexcept { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value {};
+};
+
+// Single-writer latency histogram with power-of-two microsecond buckets, laid out for a Prometheus histogram
+class LatencyBuckets {
+public:
+    static constexpr size_t s_BUCKETS { 24 };   // upper bounds 1 us .. 2^22 us (about 4 s), then +Inf
+
+    void record(std::chrono::nanoseconds elapsed) noexcept
+    {
+        uint64_t nanos  = static_cast<uint64_t>(elapsed.count());
+        uint64_t micros = (nanos + 999) / 1000;
+        size_t index    = micros <= 1 ? 0 : 64 - __builtin_clzll(micros - 1);
+        m_counts[index < s_BUCKETS ? index : s_BUCKETS - 1].add();
+        m_sum_ns.add(nanos);
+    }
+
+    uint64_t bucket(size_t index) const noexcept { return m_counts[index].load(); }
+    uint64_t sum_ns() const noexcept { return m_sum_ns.load(); }
+
+    // Upper bound in microseconds of the bucket holding the `quantile` sample, 0 when nothing was recorded
+    uint64_t percentile_us(double quantile) const noexcept
+    {
+        uint64_t total {};
+        for (size_t index {}; index < s_BUCKETS; ++index) {
+            total += bucket(index);
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * total + 0.5));
+        uint64_t seen {};
+        for (size_t index {}; index < s_BUCKETS && total != 0; ++index) {
+            seen += bucket(index);
+            if (seen >= rank) {
+                return uint64_t { 1 } << index;
+            }
+        }
+        return 0;
+    }
+
+    // Upper bound of `index` in seconds; the last bucket is unbounded
+    static double s_upper_bound(size_t index) noexcept { return static_cast<double>(uint64_t { 1 } << index) / 1e6; }
+
+private:
+    Counter m_counts[s_BUCKETS];
+    Counter m_sum_ns;
+};
+
+// Everything one reactor thread counts about itself and its connections. Each shard owns one and is its only
+// writer; the stats command and the scrape endpoint read it from other threads. Aligned so neighbouring
+// shards never share a cache line.
+struct alignas(64) ShardMetrics {
+    Counter accepted;   // connections that completed the HELLO handshake
+    Counter closed;
+    Counter handshakes;   // gauge, accepted but not yet greeted
+    Counter handshake_timeouts;
+    Counter idle_timeouts;
+    Counter heartbeats;    // PINGs sent
+    Counter timers;        // gauge, armed timers in the shard's wheel
+    Counter connections;   // gauge
+    Counter bytes_in;
+    Counter bytes_out;
+    Counter messages_in;
+    Counter messages_out;   // frames queued to clients
+    Counter send_errors;
+    Counter slow_consumers;
+    Counter inbox_drops;
+    Counter queued_bytes;   // gauge, outbound backlog over all connections
+    Counter loop_iterations;
+    Counter history_bytes;   // gauge
+    LatencyBuckets loop_latency;     // from wait() returning to the end of event handling
+    LatencyBuckets fanout_latency;   // one broadcast across this shard's connections
+};
+
+// Per-connection counters, owned by the connection's shard
+struct ConnectionMetrics {
+    uint64_t bytes_in {};
+    uint64_t bytes_out {};
+    uint64_t messages_in {};
+    uint64_t messages_out {};
+    uint64_t send_errors {};
+};
+
+inline void AppendMetric(std::string& out, char const* name, char const* labels, double value) noexcept
+{
+    char line[256];
+    int32_t len = std::snprintf(line, sizeof(line), "%s{%s} %.17g\n", name, labels, value);
+    out.append(line, len < 0 ? 0 : std::min<size_t>(len, sizeof(line) - 1));
+}
+
+inline void AppendMetricHeader(std::string& out, char const* name, char const* type, char const* help) noexcept
+{
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+inline void AppendHistogram(std::string& out, char const* name, char const* labels, LatencyBuckets const& histogram) noexcept
+{
+    std::string bucket_name = std::string { name } + "_bucket";
+    char bucket_labels[128];
+    uint64_t cumulative {};
+    for (size_t index {}; index < LatencyBuckets::s_BUCKETS; ++index) {
+        cumulative += histogram.bucket(index);
+        if (index + 1 < LatencyBuckets::s_BUCKETS) {
+            std::snprintf(bucket_labels, sizeof(bucket_labels), "%s,le=\"%g\"", labels, LatencyBuckets::s_upper_bound(index));
+        } else {
+            std::snprintf(bucket_labels, sizeof(bucket_labels), "%s,le=\"+Inf\"", labels);
+        }
+        AppendMetric(out, bucket_name.c_str(), bucket_labels, static_cast<double>(cumulative));
+    }
+    AppendMetric(out, (std::string { name } + "_sum").c_str(), labels, histogram.sum_ns() / 1e9);
+    AppendMetric(out, (std::string { name } + "_count").c_str(), labels, static_cast<double>(cumulative));
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef PACER
+#define PACER
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// Send-rate options shared by the frame senders, "--rate KBPS" and "--aimd"
+struct PacingConfig {
+    double rate_kbps {};   // 0 means unpaced; the starting rate under AIMD
+    bool aimd {};
+};
+
+// Removes the pacing options from argv so each program keeps its positional arguments
+inline PacingConfig ExtractPacingConfig(int& argc, char** argv) noexcept
+{
+    PacingConfig config;
+    for (int arg = 1; arg < argc;) {
+        int taken = 0;
+        if (std::strcmp(argv[arg], "--aimd") == 0) {
+            config.aimd = true;
+            taken       = 1;
+        } else if (std::strcmp(argv[arg], "--rate") == 0) {
+            if (arg + 1 == argc) {
+                std::fprintf(stderr, "--rate needs a value\n");
+                std::exit(EXIT_FAILURE);
+            }
+            config.rate_kbps = std::atof(argv[arg + 1]);
+            taken            = 2;
+            if (config.rate_kbps <= 0) {
+                std::fprintf(stderr, "Invalid rate %s\n", argv[arg + 1]);
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        if (taken == 0) {
+            ++arg;
+            continue;
+        }
+        for (int rest = arg; rest + taken < argc; ++rest) {
+            argv[rest] = argv[rest + taken];
+        }
+        argc -= taken;
+    }
+    return config;
+}
+
+// Token bucket in bytes, refilled continuously at `rate` and timed in nanoseconds. A send may go once the bucket
+// holds its size, or is full for sends larger than the bucket, so bursts stay within `depth` while the long-run
+// rate is exact. Rate 0 means unpaced.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket(double rate_bytes_per_s, double depth_bytes, Clock::time_point now = Clock::now()) noexcept
+        : m_rate { rate_bytes_per_s }
+        , m_depth { depth_bytes }
+        , m_tokens { depth_bytes }
+        , m_last { now }
+    {
+    }
+
+    void set_rate(double rate_bytes_per_s, Clock::time_point now) noexcept
+    {
+        m_refill(now);
+        m_rate = rate_bytes_per_s;
+    }
+
+    double rate() const noexcept { return m_rate; }
+    uint64_t waits() const noexcept { return m_waits; }
+
+    // Nanoseconds until `bytes` may be sent, 0 when it may go now
+    int64_t wait_ns(size_t bytes, Clock::time_point now) noexcept
+    {
+        if (m_rate <= 0) {
+            return 0;
+        }
+        m_refill(now);
+        double need = std::min<double>(bytes, m_depth);
+        return m_tokens >= need ? 0 : static_cast<int64_t>(std::ceil((need - m_tokens) / m_rate * 1e9));
+    }
+
+    // Sends larger than the bucket leave it in debt, which the next wait pays off
+    void take(size_t bytes) noexcept
+    {
+        if (m_rate > 0) {
+            m_tokens -= bytes;
+        }
+    }
+
+    // Blocks until `bytes` may go, then takes them. Sleeps to an absolute CLOCK_MONOTONIC deadline, the clock
+    // steady_clock reads, so a signal or a late wakeup never stretches the schedule.
+    void pace(size_t bytes) noexcept
+    {
+        for (int64_t wait; (wait = wait_ns(bytes, Clock::now())) > 0;) {
+            auto deadline = std::chrono::duration_cast<std::chrono::nanoseconds>((Clock::now() + std::chrono::nanoseconds(wait)).time_since_epoch());
+            timespec until { static_cast<time_t>(deadline.count() / 1000000000), static_cast<long>(deadline.count() % 1000000000) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+            ++m_waits;
+        }
+        take(bytes);
+    }
+
+private:
+    void m_refill(Clock::time_point now) noexcept
+    {
+        if (now > m_last) {
+            m_tokens = std::min(m_depth, m_tokens + m_rate * std::chrono::duration<double>(now - m_last).count());
+            m_last   = now;
+        }
+    }
+
+    double m_rate;
+    double const m_depth;
+    double m_tokens;
+    Clock::time_point m_last;
+    uint64_t m_waits {};
+};
+
+// AIMD on a window of frames: slow start grows the window by one frame per ACK, congestion avoidance by one
+// frame per round trip, and a congestion signal cuts it by s_BETA at most once per round trip. A loss is one
+// signal; an RTT sample well above the smallest seen is the other, since it means a queue is building at the
+// bottleneck, so the window settles near the path's capacity instead of filling its buffers. Delay signals come
+// long before a buffer overflows, so the cut is CUBIC's 0.7 rather than Reno's half, which would leave the link
+// idle after each one. The sender paces one window per smoothed RTT.
+class AimdController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit AimdController(double max_window) noexcept
+        : m_max_window { max_window }
+        , m_ssthresh { max_window }
+    {
+    }
+
+    // `rtt_ms` is negative when the ACK gave no sample (Karn)
+    void on_ack(double rtt_ms, double srtt_ms, Clock::time_point now) noexcept
+    {
+        if (rtt_ms >= 0) {
+            m_min_rtt_ms = std::min(m_min_rtt_ms, rtt_ms);
+            if (rtt_ms > m_min_rtt_ms * s_DELAY_FACTOR + s_DELAY_SLACK_MS) {
+                m_back_off(srtt_ms, now, m_delay_signals);
+                return;
+            }
+        }
+        m_window = std::min(m_max_window, m_window + (m_window < m_ssthresh ? 1 : 1 / m_window));
+    }
+
+    void on_loss(double srtt_ms, Clock::time_point now) noexcept { m_back_off(srtt_ms, now, m_loss_signals); }
+
+    double window() const noexcept { return m_window; }
+    double min_rtt_ms() const noexcept { return m_min_rtt_ms; }
+    uint64_t loss_signals() const noexcept { return m_loss_signals; }
+    uint64_t delay_signals() const noexcept { return m_delay_signals; }
+
+    // Bytes per second that spread one window over one smoothed RTT, with headroom so pacing alone never holds
+    // the window below what the ACK clock allows
+    double rate(double srtt_ms, size_t frame_bytes) const noexcept
+    {
+        return s_PACING_GAIN * m_window * frame_bytes / (std::max(srtt_ms, 0.001) / 1000);
+    }
+
+private:
+    static constexpr double s_BETA { 0.7 };
+    static constexpr double s_DELAY_FACTOR { 1.5 };
+    static constexpr double s_DELAY_SLACK_MS { 2.0 };   // keeps scheduler noise on sub-millisecond paths from counting as queueing
+    static constexpr double s_PACING_GAIN { 1.25 };
+
+    void m_back_off(double srtt_ms, Clock::time_point now, uint64_t& signals) noexcept
+    {
+        if (now < m_hold_until) {
+            return;   // the rest of this round trip still reflects the old window
+        }
+        ++signals;
+        m_window     = std::max(1.0, m_window * s_BETA);
+        m_ssthresh   = m_window;
+        m_hold_until = now + std::chrono::microseconds(static_cast<int64_t>(srtt_ms * 1000));
+    }
+
+    double const m_max_window;
+    double m_window { 2 };
+    double m_ssthresh;
+    double m_min_rtt_ms { INFINITY };
+    Clock::time_point m_hold_until {};
+    uint64_t m_loss_signals {};
+    uint64_t m_delay_signals {};
+};
+
+#endif
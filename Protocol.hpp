@@ -0,0 +1,199 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Every message on a chat stream is a fixed header followed by `length` payload bytes.
+//
+//   0         1        2            4            8            12
+//   | version | type   | topic      | sender     | length     | payload ...
+//
+// Multi-byte fields are big-endian. `sender` is the server-assigned connection id (0 for the server itself).
+// `topic` names the room a CHAT belongs to or a JOIN/LEAVE refers to; topic 0 is the lobby every client
+// starts in, and where notices go.
+
+enum class FrameType : uint8_t {
+    HELLO  = 1,   // client -> server, payload is the username
+    CHAT   = 2,   // client -> server message body, server -> client formatted message
+    NOTICE = 3,   // server -> client status line
+    JOIN   = 4,   // client -> server, subscribe to `topic`, no payload
+    LEAVE  = 5,   // client -> server, unsubscribe from `topic`, no payload
+    PING   = 6,   // either way, no payload; the other side answers with PONG
+    PONG   = 7    // either way, no payload
+};
+
+struct FrameHeader {
+    uint8_t version;
+    FrameType type;
+    uint16_t topic;
+    uint32_t sender;
+    uint32_t length;
+};
+
+constexpr uint8_t s_PROTOCOL_VERSION { 1 };
+constexpr size_t s_FRAME_HEADER_SIZE { 12 };
+constexpr uint32_t s_MAX_PAYLOAD { 4096 };
+
+inline void EncodeHeader(char* out, FrameType type, uint32_t sender, uint32_t length, uint16_t topic = 0) noexcept
+{
+    topic  = htons(topic);
+    sender = htonl(sender);
+    length = htonl(length);
+    out[0] = static_cast<char>(s_PROTOCOL_VERSION);
+    out[1] = static_cast<char>(type);
+    std::memcpy(out + 2, &topic, sizeof(topic));
+    std::memcpy(out + 4, &sender, sizeof(sender));
+    std::memcpy(out + 8, &length, sizeof(length));
+}
+
+inline FrameHeader DecodeHeader(char const* in) noexcept
+{
+    FrameHeader header;
+    header.version = static_cast<uint8_t>(in[0]);
+    header.type    = static_cast<FrameType>(in[1]);
+    std::memcpy(&header.topic, in + 2, sizeof(header.topic));
+    std::memcpy(&header.sender, in + 4, sizeof(header.sender));
+    std::memcpy(&header.length, in + 8, sizeof(header.length));
+    header.topic  = ntohs(header.topic);
+    header.sender = ntohl(header.sender);
+    header.length = ntohl(header.length);
+    return header;
+}
+
+// Power-of-two byte ring. fill() reads straight from a socket into both free spans with one readv,
+// so a single syscall can pull in many frames.
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity) noexcept
+        : m_mask { s_round_up(capacity) - 1 }
+        , m_data { new char[m_mask + 1] }
+    {
+    }
+
+    size_t size() const noexcept { return m_tail - m_head; }
+    size_t space() const noexcept { return m_mask + 1 - size(); }
+
+    ssize_t fill(int32_t fd) noexcept
+    {
+        size_t tail  = m_tail & m_mask;
+        size_t first = std::min(space(), m_mask + 1 - tail);
+        iovec spans[2] {
+            { m_data.get() + tail, first },
+            { m_data.get(), space() - first }
+        };
+        ssize_t read_bytes = readv(fd, spans, spans[1].iov_len ? 2 : 1);
+        if (read_bytes > 0) {
+            m_tail += read_bytes;
+        }
+        return read_bytes;
+    }
+
+    size_t append(char const* data, size_t len) noexcept
+    {
+        len          = std::min(len, space());
+        size_t tail  = m_tail & m_mask;
+        size_t first = std::min(len, m_mask + 1 - tail);
+        std::memcpy(m_data.get() + tail, data, first);
+        std::memcpy(m_data.get(), data + first, len - first);
+        m_tail += len;
+        return len;
+    }
+
+    void copy_out(size_t offset, char* out, size_t len) const noexcept
+    {
+        size_t start = (m_head + offset) & m_mask;
+        size_t first = std::min(len, m_mask + 1 - start);
+        std::memcpy(out, m_data.get() + start, first);
+        std::memcpy(out + first, m_data.get(), len - first);
+    }
+
+    // Pointer to [offset, offset + len) if it does not wrap, nullptr otherwise
+    char const* contiguous(size_t offset, size_t len) const noexcept
+    {
+        size_t start = (m_head + offset) & m_mask;
+        return start + len <= m_mask + 1 ? m_data.get() + start : nullptr;
+    }
+
+    void consume(size_t len) noexcept { m_head += len; }
+
+private:
+    static size_t s_round_up(size_t capacity) noexcept
+    {
+        size_t size { 64 };
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    size_t const m_mask;
+    std::unique_ptr<char[]> m_data;
+    size_t m_head {};
+    size_t m_tail {};
+};
+
+// Incremental frame decoder over a per-connection RingBuffer
+class FrameParser {
+public:
+    explicit FrameParser(size_t capacity = s_FRAME_HEADER_SIZE + s_MAX_PAYLOAD) noexcept
+        : m_ring { capacity }
+    {
+    }
+
+    ssize_t fill(int32_t fd) noexcept { return m_ring.fill(fd); }
+
+    // For completion-based I/O where the bytes were already received elsewhere; returns how many fit
+    size_t feed(char const* data, size_t len) noexcept
+    {
+        m_ring.consume(m_pending);
+        m_pending = 0;
+        return m_ring.append(data, len);
+    }
+
+    // Pops the next complete frame. The payload points into the ring (or a scratch copy when it wraps)
+    // and stays valid until the following call.
+    bool next(FrameHeader& header, char const*& payload) noexcept
+    {
+        m_ring.consume(m_pending);
+        m_pending = 0;
+        if (m_error || m_ring.size() < s_FRAME_HEADER_SIZE) {
+            return false;
+        }
+        char raw[s_FRAME_HEADER_SIZE];
+        m_ring.copy_out(0, raw, s_FRAME_HEADER_SIZE);
+        header = DecodeHeader(raw);
+        if (header.version != s_PROTOCOL_VERSION || header.length > s_MAX_PAYLOAD) {
+            m_error = true;
+            return false;
+        }
+        if (m_ring.size() < s_FRAME_HEADER_SIZE + header.length) {
+            return false;
+        }
+        payload = m_ring.contiguous(s_FRAME_HEADER_SIZE, header.length);
+        if (payload == nullptr) {
+            m_scratch.resize(s_MAX_PAYLOAD);
+            m_ring.copy_out(s_FRAME_HEADER_SIZE, m_scratch.data(), header.length);
+            payload = m_scratch.data();
+        }
+        m_pending = s_FRAME_HEADER_SIZE + header.length;
+        return true;
+    }
+
+    bool error() const noexcept { return m_error; }
+
+private:
+    RingBuffer m_ring;
+    std::vector<char> m_scratch;
+    size_t m_pending {};
+    bool m_error {};
+};
+
+#endif
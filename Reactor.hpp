@@ -0,0 +1,677 @@
+#ifndef REACTOR
+#define REACTOR
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT)
+#define CN_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "SharedBuffer.hpp"
+
+enum class Backend : uint8_t {
+    POLL,
+    EPOLL,
+    IO_URING
+};
+
+#if defined(CN_USE_POLL)
+#define _DEFAULT_BACKEND_ Backend::POLL
+#elif defined(CN_USE_IO_URING)
+#define _DEFAULT_BACKEND_ Backend::IO_URING
+#else
+#define _DEFAULT_BACKEND_ Backend::EPOLL
+#endif
+
+// Interest flags passed to add/modify, readiness flags reported in ReactorEvent::flags
+enum REACTOR_FLAGS : uint32_t {
+    EV_READ   = 1U << 0,
+    EV_WRITE  = 1U << 1,
+    EV_EDGE   = 1U << 2,   // ignored by level-triggered backends, handlers must drain until EAGAIN anyway
+    EV_HANGUP = 1U << 3,
+    EV_ERROR  = 1U << 4,
+    EV_ACCEPT = 1U << 5,   // completion backends: result is the accepted fd
+    EV_DATA   = 1U << 6,   // completion backends: result bytes at data, 0 on EOF, -errno on failure
+    EV_SENT   = 1U << 7    // completion backends: result bytes written or -errno
+};
+
+struct ReactorEvent {
+    int32_t fd;
+    uint32_t flags;
+    int32_t result {};
+    char const* data {};   // valid until the next wait()
+};
+
+class Reactor {
+public:
+    virtual ~Reactor() noexcept = default;
+
+    virtual bool add(int32_t fd, uint32_t interest) noexcept    = 0;
+    virtual bool modify(int32_t fd, uint32_t interest) noexcept = 0;
+    virtual void remove(int32_t fd) noexcept                    = 0;
+    virtual int32_t wait(int32_t tout_in_mill) noexcept         = 0;
+    virtual char const* name() const noexcept                   = 0;
+
+    // Completion backends accept, receive and send on the caller's behalf and report EV_ACCEPT, EV_DATA
+    // and EV_SENT. Readiness backends register plain interest and leave the syscalls to the caller.
+    virtual bool completion_based() const noexcept { return false; }
+    virtual bool add_listener(int32_t fd) noexcept { return add(fd, EV_READ); }
+    virtual bool add_stream(int32_t fd) noexcept { return add(fd, EV_READ | EV_EDGE); }
+    virtual bool submit_send(int32_t, SharedBuffer const&, size_t, size_t, bool) noexcept { return false; }
+
+    ReactorEvent const* begin() const noexcept { return m_events.data(); }
+    ReactorEvent const* end() const noexcept { return m_events.data() + m_ready; }
+
+    static std::unique_ptr<Reactor> create(Backend backend) noexcept;
+
+protected:
+    std::vector<ReactorEvent> m_events;
+    int32_t m_ready {};
+};
+
+class PollReactor final : public Reactor {
+public:
+    bool add(int32_t fd, uint32_t interest) noexcept override
+    {
+        if (static_cast<size_t>(fd) >= m_slot.size()) {
+            m_slot.resize(fd + 1, -1);
+        }
+        if (m_slot[fd] != -1) {
+            return false;
+        }
+        m_slot[fd] = static_cast<int32_t>(m_pollfd_set.size());
+        m_pollfd_set.push_back({ fd, s_to_poll(interest), 0 });
+        return true;
+    }
+
+    bool modify(int32_t fd, uint32_t interest) noexcept override
+    {
+        if (static_cast<size_t>(fd) >= m_slot.size() || m_slot[fd] == -1) {
+            return false;
+        }
+        m_pollfd_set[m_slot[fd]].events = s_to_poll(interest);
+        return true;
+    }
+
+    void remove(int32_t fd) noexcept override
+    {
+        if (static_cast<size_t>(fd) >= m_slot.size() || m_slot[fd] == -1) {
+            return;
+        }
+        int32_t slot = m_slot[fd];
+        m_slot[fd]   = -1;
+        if (static_cast<size_t>(slot) != m_pollfd_set.size() - 1) {
+            m_pollfd_set[slot]            = m_pollfd_set.back();
+            m_slot[m_pollfd_set[slot].fd] = slot;
+        }
+        m_pollfd_set.pop_back();
+    }
+
+    int32_t wait(int32_t tout_in_mill) noexcept override
+    {
+        // Sized here rather than in add(), which may run while the caller is still walking the last batch
+        m_ready = 0;
+        if (m_events.size() < m_pollfd_set.size()) {
+            m_events.resize(m_pollfd_set.size());
+        }
+        int32_t poll_stat = poll(m_pollfd_set.data(), m_pollfd_set.size(), tout_in_mill);
+        if (poll_stat <= 0) {
+            return poll_stat;
+        }
+        for (pollfd const& poll_fd : m_pollfd_set) {
+            if (poll_fd.revents) {
+                m_events[m_ready++] = { poll_fd.fd, s_from_poll(poll_fd.revents) };
+            }
+        }
+        return m_ready;
+    }
+
+    char const* name() const noexcept override { return "poll"; }
+
+private:
+    static short s_to_poll(uint32_t interest) noexcept
+    {
+        return (interest & EV_READ ? POLLIN : 0) | (interest & EV_WRITE ? POLLOUT : 0);
+    }
+
+    static uint32_t s_from_poll(short revents) noexcept
+    {
+        return (revents & POLLIN ? EV_READ : 0U)
+             | (revents & POLLOUT ? EV_WRITE : 0U)
+             | (revents & POLLHUP ? EV_HANGUP : 0U)
+             | (revents & (POLLERR | POLLNVAL) ? EV_ERROR : 0U);
+    }
+
+    std::vector<pollfd> m_pollfd_set;
+    std::vector<int32_t> m_slot;   // fd -> index into m_pollfd_set
+};
+
+class EpollReactor final : public Reactor {
+public:
+    EpollReactor() noexcept
+        : m_EPOLL_FD { epoll_create1(EPOLL_CLOEXEC) }
+    {
+        if (m_EPOLL_FD == -1) {
+            std::fprintf(stderr, "Could not create epoll instance\n");
+            std::fflush(stderr);
+        }
+        m_epoll_events.resize(s_MAX_EVENTS);
+        m_events.resize(s_MAX_EVENTS);
+    }
+
+    ~EpollReactor() noexcept override
+    {
+        if (m_EPOLL_FD != -1) {
+            close(m_EPOLL_FD);
+        }
+    }
+
+    bool valid() const noexcept { return m_EPOLL_FD != -1; }
+
+    bool add(int32_t fd, uint32_t interest) noexcept override
+    {
+        epoll_event event { s_to_epoll(interest), {} };
+        event.data.fd = fd;
+        return epoll_ctl(m_EPOLL_FD, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    bool modify(int32_t fd, uint32_t interest) noexcept override
+    {
+        epoll_event event { s_to_epoll(interest), {} };
+        event.data.fd = fd;
+        return epoll_ctl(m_EPOLL_FD, EPOLL_CTL_MOD, fd, &event) == 0;
+    }
+
+    void remove(int32_t fd) noexcept override
+    {
+        epoll_ctl(m_EPOLL_FD, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    int32_t wait(int32_t tout_in_mill) noexcept override
+    {
+        m_ready            = 0;
+        int32_t epoll_stat = epoll_wait(m_EPOLL_FD, m_epoll_events.data(), m_epoll_events.size(), tout_in_mill);
+        if (epoll_stat <= 0) {
+            return epoll_stat;
+        }
+        for (; m_ready < epoll_stat; ++m_ready) {
+            m_events[m_ready] = { m_epoll_events[m_ready].data.fd, s_from_epoll(m_epoll_events[m_ready].events) };
+        }
+        return m_ready;
+    }
+
+    char const* name() const noexcept override { return "epoll"; }
+
+private:
+    static uint32_t s_to_epoll(uint32_t interest) noexcept
+    {
+        return (interest & EV_READ ? EPOLLIN | EPOLLRDHUP : 0U)
+             | (interest & EV_WRITE ? EPOLLOUT : 0U)
+             | (interest & EV_EDGE ? EPOLLET : 0U);
+    }
+
+    static uint32_t s_from_epoll(uint32_t events) noexcept
+    {
+        return (events & (EPOLLIN | EPOLLRDHUP) ? EV_READ : 0U)
+             | (events & EPOLLOUT ? EV_WRITE : 0U)
+             | (events & EPOLLHUP ? EV_HANGUP : 0U)
+             | (events & EPOLLERR ? EV_ERROR : 0U);
+    }
+
+    static constexpr int32_t s_MAX_EVENTS { 1024 };
+
+    int32_t const m_EPOLL_FD;
+    std::vector<epoll_event> m_epoll_events;
+};
+
+#if defined(CN_HAVE_IO_URING)
+// Completion-based backend on raw io_uring syscalls: multishot accept, multishot recv into a provided
+// buffer ring, multishot poll for plain descriptors and (optionally linked) sends that keep a reference
+// to their SharedBuffer until the kernel is done with it.
+class IoUringReactor final : public Reactor {
+public:
+    IoUringReactor() noexcept
+    {
+        m_valid = m_setup();
+    }
+
+    ~IoUringReactor() noexcept override
+    {
+        if (m_buf_ring != MAP_FAILED) {
+            munmap(m_buf_ring, m_buf_ring_size);
+        }
+        if (m_sqes != MAP_FAILED) {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_ring != MAP_FAILED) {
+            munmap(m_ring, m_ring_size);
+        }
+        if (m_RING_FD != -1) {
+            close(m_RING_FD);
+        }
+    }
+
+    bool valid() const noexcept { return m_valid; }
+    bool completion_based() const noexcept override { return true; }
+    char const* name() const noexcept override { return "io_uring"; }
+
+    bool add(int32_t fd, uint32_t interest) noexcept override
+    {
+        m_track(fd, KIND_POLL, interest);
+        return m_arm(fd);
+    }
+
+    bool modify(int32_t fd, uint32_t interest) noexcept override
+    {
+        remove(fd);
+        return add(fd, interest);
+    }
+
+    void remove(int32_t fd) noexcept override
+    {
+        if (static_cast<size_t>(fd) >= m_fds.size() || m_fds[fd].kind == KIND_NONE) {
+            return;
+        }
+        FdState& state = m_fds[fd];
+        if (io_uring_sqe* sqe = m_get_sqe()) {
+            sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+            sqe->fd        = -1;
+            sqe->addr      = s_tag(state.kind, fd, state.gen);
+            sqe->user_data = s_tag(KIND_CANCEL, fd, 0);
+        }
+        state.kind = KIND_NONE;
+        state.gen  = (state.gen + 1) & s_GEN_MASK;
+    }
+
+    bool add_listener(int32_t fd) noexcept override
+    {
+        m_track(fd, KIND_ACCEPT, EV_READ);
+        return m_arm(fd);
+    }
+
+    bool add_stream(int32_t fd) noexcept override
+    {
+        m_track(fd, KIND_RECV, EV_READ);
+        return m_arm(fd);
+    }
+
+    // Sends `len` bytes of `buffer` from `offset`, holding a reference until the completion arrives. MSG_WAITALL
+    // makes the kernel retry a partial send itself and fail the request if it still ends short, which breaks the
+    // link; without it a short send counts as success and the next linked slice would follow a torn one.
+    bool submit_send(int32_t fd, SharedBuffer const& buffer, size_t offset, size_t len, bool link) noexcept override
+    {
+        io_uring_sqe* sqe = m_get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        uint32_t slot;
+        if (m_free_slots.empty()) {
+            slot = static_cast<uint32_t>(m_slots.size());
+            m_slots.emplace_back();
+        } else {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+        m_slots[slot]  = { buffer, fd, m_fds[fd].gen };
+        sqe->opcode    = IORING_OP_SEND;
+        sqe->fd        = fd;
+        sqe->addr      = reinterpret_cast<uint64_t>(buffer.data() + offset);
+        sqe->len       = static_cast<uint32_t>(len);
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags     = link ? IOSQE_IO_LINK : 0;
+        sqe->user_data = (static_cast<uint64_t>(KIND_SEND) << 56) | slot;
+        return true;
+    }
+
+    int32_t wait(int32_t tout_in_mill) noexcept override
+    {
+        m_ready = 0;
+        m_recycle();
+
+        uint32_t flags        = IORING_ENTER_GETEVENTS;
+        uint32_t min_complete = tout_in_mill != 0 && m_cq_empty() ? 1 : 0;
+        __kernel_timespec timeout { tout_in_mill / 1000, (tout_in_mill % 1000) * 1000000LL };
+        io_uring_getevents_arg arg {};
+        if (tout_in_mill > 0) {
+            arg.ts = reinterpret_cast<uint64_t>(&timeout);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+        if (m_enter(min_complete, flags, flags & IORING_ENTER_EXT_ARG ? &arg : nullptr) == -1 && errno != ETIME) {
+            return -1;
+        }
+
+        uint32_t head = *m_cq_head;
+        uint32_t tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            m_complete(m_cqes[head & *m_cq_mask]);
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        return m_ready;
+    }
+
+private:
+    enum KIND : uint8_t {
+        KIND_NONE,
+        KIND_POLL,
+        KIND_ACCEPT,
+        KIND_RECV,
+        KIND_SEND,
+        KIND_CANCEL
+    };
+
+    struct FdState {
+        KIND kind { KIND_NONE };
+        uint32_t gen {};   // bumped on remove so completions for a recycled fd number are ignored
+        uint32_t interest {};
+    };
+
+    struct SendSlot {
+        SharedBuffer buffer;
+        int32_t fd {};
+        uint32_t gen {};
+    };
+
+    // user_data: kind in the top byte, then a 24-bit generation and the fd (or send slot) in the low half
+    static uint64_t s_tag(KIND kind, int32_t fd, uint32_t gen) noexcept
+    {
+        return (static_cast<uint64_t>(kind) << 56) | (static_cast<uint64_t>(gen & s_GEN_MASK) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    bool m_setup() noexcept
+    {
+        io_uring_params params {};
+        params.flags      = IORING_SETUP_CQSIZE;
+        params.cq_entries = s_SQ_ENTRIES * 4;
+        m_RING_FD         = static_cast<int32_t>(syscall(__NR_io_uring_setup, s_SQ_ENTRIES, &params));
+        if (m_RING_FD == -1) {
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+            return false;
+        }
+
+        m_ring_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                                       params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        m_ring      = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RING_FD, IORING_OFF_SQ_RING);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes      = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RING_FD, IORING_OFF_SQES);
+        if (m_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+            return false;
+        }
+        char* ring  = static_cast<char*>(m_ring);
+        m_sq_head   = reinterpret_cast<uint32_t*>(ring + params.sq_off.head);
+        m_sq_ktail  = reinterpret_cast<uint32_t*>(ring + params.sq_off.tail);
+        m_sq_mask   = reinterpret_cast<uint32_t*>(ring + params.sq_off.ring_mask);
+        m_sq_array  = reinterpret_cast<uint32_t*>(ring + params.sq_off.array);
+        m_sq_size   = params.sq_entries;
+        m_cq_head   = reinterpret_cast<uint32_t*>(ring + params.cq_off.head);
+        m_cq_tail   = reinterpret_cast<uint32_t*>(ring + params.cq_off.tail);
+        m_cq_mask   = reinterpret_cast<uint32_t*>(ring + params.cq_off.ring_mask);
+        m_cqes      = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+        m_sq_tail   = *m_sq_ktail;
+        m_submitted = m_sq_tail;
+
+        m_buf_ring_size = s_BUF_COUNT * sizeof(io_uring_buf);
+        m_buf_ring      = mmap(nullptr, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (m_buf_ring == MAP_FAILED) {
+            return false;
+        }
+        io_uring_buf_reg reg {};
+        reg.ring_addr    = reinterpret_cast<uint64_t>(m_buf_ring);
+        reg.ring_entries = s_BUF_COUNT;
+        reg.bgid         = s_BUF_GROUP;
+        if (syscall(__NR_io_uring_register, m_RING_FD, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+            return false;
+        }
+        m_buf_memory.reset(new (std::nothrow) char[s_BUF_COUNT * s_BUF_SIZE]);
+        if (!m_buf_memory) {
+            return false;
+        }
+        for (uint16_t bid {}; bid < s_BUF_COUNT; ++bid) {
+            m_lent.push_back(bid);
+        }
+        m_recycle();
+        m_events.resize(params.cq_entries);
+        return true;
+    }
+
+    void m_track(int32_t fd, KIND kind, uint32_t interest) noexcept
+    {
+        if (static_cast<size_t>(fd) >= m_fds.size()) {
+            m_fds.resize(fd + 1);
+        }
+        m_fds[fd].kind     = kind;
+        m_fds[fd].interest = interest;
+    }
+
+    bool m_arm(int32_t fd) noexcept
+    {
+        io_uring_sqe* sqe = m_get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        FdState const& state = m_fds[fd];
+        sqe->fd              = fd;
+        sqe->user_data       = s_tag(state.kind, fd, state.gen);
+        switch (state.kind) {
+            case KIND_POLL:
+                sqe->opcode        = IORING_OP_POLL_ADD;
+                sqe->len           = IORING_POLL_ADD_MULTI;
+                sqe->poll32_events = (state.interest & EV_READ ? POLLIN : 0) | (state.interest & EV_WRITE ? POLLOUT : 0);
+                break;
+            case KIND_ACCEPT:
+                sqe->opcode       = IORING_OP_ACCEPT;
+                sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+                sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+                break;
+            case KIND_RECV:
+                sqe->opcode    = IORING_OP_RECV;
+                sqe->ioprio    = IORING_RECV_MULTISHOT;
+                sqe->flags     = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = s_BUF_GROUP;
+                break;
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    void m_complete(io_uring_cqe const& cqe) noexcept
+    {
+        KIND kind = static_cast<KIND>(cqe.user_data >> 56);
+        if (kind == KIND_CANCEL) {
+            return;
+        }
+        if (kind == KIND_SEND) {
+            SendSlot& slot = m_slots[cqe.user_data & 0xFFFFFFFF];
+            if (static_cast<size_t>(slot.fd) < m_fds.size() && m_fds[slot.fd].gen == slot.gen) {
+                m_emit({ slot.fd, EV_SENT, cqe.res });
+            }
+            slot.buffer = {};
+            m_free_slots.push_back(static_cast<uint32_t>(&slot - m_slots.data()));
+            return;
+        }
+
+        int32_t fd   = static_cast<int32_t>(cqe.user_data & 0xFFFFFFFF);
+        bool current = static_cast<size_t>(fd) < m_fds.size() && m_fds[fd].kind == kind
+                    && m_fds[fd].gen == ((cqe.user_data >> 32) & s_GEN_MASK);
+        bool more    = cqe.flags & IORING_CQE_F_MORE;
+        if (kind == KIND_RECV) {
+            char const* data = nullptr;
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                data         = m_buf_memory.get() + static_cast<size_t>(bid) * s_BUF_SIZE;
+                m_lent.push_back(bid);
+            }
+            if (!current) {
+                return;
+            }
+            if (cqe.res != -ENOBUFS) {
+                m_emit({ fd, EV_DATA, cqe.res, data });
+            }
+            if (!more && (cqe.res > 0 || cqe.res == -ENOBUFS)) {
+                m_arm(fd);
+            }
+        } else if (kind == KIND_ACCEPT) {
+            if (!current) {
+                cqe.res >= 0 ? static_cast<void>(close(cqe.res)) : void();
+                return;
+            }
+            if (cqe.res >= 0) {
+                m_emit({ fd, EV_ACCEPT, cqe.res });
+            }
+            if (!more) {
+                m_arm(fd);
+            }
+        } else if (kind == KIND_POLL && current) {
+            if (cqe.res > 0) {
+                m_emit({ fd,
+                         (cqe.res & POLLIN ? EV_READ : 0U) | (cqe.res & POLLOUT ? EV_WRITE : 0U)
+                             | (cqe.res & POLLHUP ? EV_HANGUP : 0U) | (cqe.res & (POLLERR | POLLNVAL) ? EV_ERROR : 0U) });
+            }
+            if (!more) {
+                m_arm(fd);
+            }
+        }
+    }
+
+    void m_emit(ReactorEvent const& event) noexcept
+    {
+        if (static_cast<size_t>(m_ready) == m_events.size()) {
+            m_events.resize(m_events.size() * 2);
+        }
+        m_events[m_ready++] = event;
+    }
+
+    // Provided buffers handed out by the previous wait() go back to the kernel before the next one
+    void m_recycle() noexcept
+    {
+        if (m_lent.empty()) {
+            return;
+        }
+        // The kernel header's flexible array carries an empty struct that C++ sizes as one byte, so index
+        // the ring as a plain io_uring_buf array; the tail overlays the first entry's resv field.
+        auto* ring = static_cast<io_uring_buf*>(m_buf_ring);
+        for (uint16_t bid : m_lent) {
+            io_uring_buf& buf = ring[m_buf_tail & (s_BUF_COUNT - 1)];
+            buf.addr          = reinterpret_cast<uint64_t>(m_buf_memory.get() + static_cast<size_t>(bid) * s_BUF_SIZE);
+            buf.len           = s_BUF_SIZE;
+            buf.bid           = bid;
+            ++m_buf_tail;
+        }
+        __atomic_store_n(&ring[0].resv, m_buf_tail, __ATOMIC_RELEASE);
+        m_lent.clear();
+    }
+
+    bool m_cq_empty() const noexcept
+    {
+        return *m_cq_head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    io_uring_sqe* m_get_sqe() noexcept
+    {
+        if (m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_size) {
+            m_enter(0, 0, nullptr);
+            if (m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_size) {
+                return nullptr;
+            }
+        }
+        uint32_t index    = m_sq_tail & *m_sq_mask;
+        io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        ++m_sq_tail;
+        return sqe;
+    }
+
+    int32_t m_enter(uint32_t min_complete, uint32_t flags, io_uring_getevents_arg* arg) noexcept
+    {
+        __atomic_store_n(m_sq_ktail, m_sq_tail, __ATOMIC_RELEASE);
+        long submitted = syscall(__NR_io_uring_enter, m_RING_FD, m_sq_tail - m_submitted, min_complete, flags, arg, arg ? sizeof(*arg) : 0);
+        if (submitted > 0) {
+            m_submitted += static_cast<uint32_t>(submitted);
+        }
+        return static_cast<int32_t>(submitted);
+    }
+
+    static constexpr uint32_t s_SQ_ENTRIES { 4096 };
+    // The pool also caps how much one wait() ingests, keeping broadcast bursts under the fan-out high water
+    static constexpr uint32_t s_BUF_COUNT { 64 };
+    static constexpr uint32_t s_BUF_SIZE { 4096 };
+    static constexpr uint16_t s_BUF_GROUP { 0 };
+    static constexpr uint32_t s_GEN_MASK { 0xFFFFFF };
+
+    int32_t m_RING_FD { -1 };
+    bool m_valid {};
+    void* m_ring { MAP_FAILED };
+    size_t m_ring_size {};
+    void* m_sqes { MAP_FAILED };
+    size_t m_sqes_size {};
+    uint32_t* m_sq_head {};
+    uint32_t* m_sq_ktail {};
+    uint32_t* m_sq_mask {};
+    uint32_t* m_sq_array {};
+    uint32_t m_sq_size {};
+    uint32_t m_sq_tail {};
+    uint32_t m_submitted {};
+    uint32_t* m_cq_head {};
+    uint32_t* m_cq_tail {};
+    uint32_t* m_cq_mask {};
+    io_uring_cqe* m_cqes {};
+
+    void* m_buf_ring { MAP_FAILED };
+    size_t m_buf_ring_size {};
+    uint16_t m_buf_tail {};
+    std::unique_ptr<char[]> m_buf_memory;
+    std::vector<uint16_t> m_lent;
+
+    std::vector<FdState> m_fds;
+    std::vector<SendSlot> m_slots;
+    std::vector<uint32_t> m_free_slots;
+};
+#endif
+
+inline std::unique_ptr<Reactor> Reactor::create(Backend backend) noexcept
+{
+#if defined(CN_HAVE_IO_URING)
+    if (backend == Backend::IO_URING) {
+        auto reactor = std::make_unique<IoUringReactor>();
+        if (reactor->valid()) {
+            return reactor;
+        }
+        std::fputs("io_uring unavailable, falling back to epoll backend\n", stderr);
+        std::fflush(stderr);
+        backend = Backend::EPOLL;
+    }
+#else
+    backend = backend == Backend::IO_URING ? Backend::EPOLL : backend;
+#endif
+    if (backend == Backend::EPOLL) {
+        auto reactor = std::make_unique<EpollReactor>();
+        if (reactor->valid()) {
+            return reactor;
+        }
+        std::fputs("Falling back to poll backend\n", stderr);
+        std::fflush(stderr);
+    }
+    return std::make_unique<PollReactor>();
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SHARED_BUFFER
+#define SHARED_BUFFER
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+// Immutable byte buffer with an intrusive atomic reference count. A broadcast is formatted once
+// into one of these and every outbound queue (on any shard) only holds a handle to it.
+class SharedBuffer {
+public:
+    SharedBuffer() noexcept = default;
+
+    static SharedBuffer make(char const* data, size_t size) noexcept
+    {
+        return make(data, size, nullptr, 0);
+    }
+
+    // Joins two pieces without staging them in a scratch buffer first
+    static SharedBuffer make(char const* head, size_t head_size, char const* tail, size_t tail_size) noexcept
+    {
+        void* memory = ::operator new(sizeof(Block) + head_size + tail_size, std::nothrow);
+        if (memory == nullptr) {
+            return {};
+        }
+        Block* block = new (memory) Block { { 1 }, head_size + tail_size };
+        std::memcpy(reinterpret_cast<char*>(block + 1), head, head_size);
+        if (tail_size != 0) {
+            std::memcpy(reinterpret_cast<char*>(block + 1) + head_size, tail, tail_size);
+        }
+        return SharedBuffer { block };
+    }
+
+    SharedBuffer(SharedBuffer const& other) noexcept
+        : m_block { other.m_block }
+    {
+        if (m_block) {
+            m_block->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedBuffer(SharedBuffer&& other) noexcept
+        : m_block { std::exchange(other.m_block, nullptr) }
+    {
+    }
+
+    SharedBuffer& operator=(SharedBuffer other) noexcept
+    {
+        std::swap(m_block, other.m_block);
+        return *this;
+    }
+
+    ~SharedBuffer() noexcept
+    {
+        if (m_block && m_block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_block->~Block();
+            ::operator delete(m_block);
+        }
+    }
+
+    char const* data() const noexcept { return reinterpret_cast<char const*>(m_block + 1); }
+    size_t size() const noexcept { return m_block ? m_block->size : 0; }
+    explicit operator bool() const noexcept { return m_block != nullptr; }
+
+private:
+    struct Block {
+        std::atomic<uint32_t> refs;
+        size_t size;
+    };
+
+    explicit SharedBuffer(Block* block) noexcept
+        : m_block { block }
+    {
+    }
+
+    Block* m_block {};
+};
+
+#endif
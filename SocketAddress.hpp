@@ -0,0 +1,137 @@
+#ifndef SOCKET_ADDRESS
+#define SOCKET_ADDRESS
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Address-family policy for the socket templates. Each specialisation turns a host string and port into the
+// family's sockaddr and says how its listeners may be shared, so TCPServer<Domain> and Client<Domain> never
+// name a concrete sockaddr type.
+template <int32_t Domain>
+class SocketAddress;
+
+template <>
+class SocketAddress<AF_INET> {
+public:
+    static constexpr bool s_REUSE_PORT { true };   // every shard can bind its own listener
+    static constexpr bool s_TCP { true };          // stream sockets take IPPROTO_TCP options
+
+    bool parse(char const* host, uint16_t port) noexcept
+    {
+        m_address.sin_family = AF_INET;
+        m_address.sin_port   = htons(port);
+        return inet_pton(AF_INET, host, &m_address.sin_addr) == 1;
+    }
+
+    sockaddr const* get() const noexcept { return reinterpret_cast<sockaddr const*>(&m_address); }
+    socklen_t size() const noexcept { return sizeof(m_address); }
+    void unlink() const noexcept { }
+
+    std::string describe() const
+    {
+        char host[INET_ADDRSTRLEN] {};
+        inet_ntop(AF_INET, &m_address.sin_addr, host, sizeof(host));
+        return std::string { host } + ":" + std::to_string(ntohs(m_address.sin_port));
+    }
+
+private:
+    sockaddr_in m_address {};
+};
+
+template <>
+class SocketAddress<AF_INET6> {
+public:
+    static constexpr bool s_REUSE_PORT { true };
+    static constexpr bool s_TCP { true };
+
+    // Accepts the bare form ("::1") as well as the bracketed one ("[::1]")
+    bool parse(char const* host, uint16_t port) noexcept
+    {
+        char bare[INET6_ADDRSTRLEN];
+        size_t len = std::strlen(host);
+        if (len >= 2 && host[0] == '[' && host[len - 1] == ']' && len - 2 < sizeof(bare)) {
+            std::memcpy(bare, host + 1, len - 2);
+            bare[len - 2] = '\0';
+            host          = bare;
+        }
+        m_address.sin6_family = AF_INET6;
+        m_address.sin6_port   = htons(port);
+        return inet_pton(AF_INET6, host, &m_address.sin6_addr) == 1;
+    }
+
+    sockaddr const* get() const noexcept { return reinterpret_cast<sockaddr const*>(&m_address); }
+    socklen_t size() const noexcept { return sizeof(m_address); }
+    void unlink() const noexcept { }
+
+    std::string describe() const
+    {
+        char host[INET6_ADDRSTRLEN] {};
+        inet_ntop(AF_INET6, &m_address.sin6_addr, host, sizeof(host));
+        return "[" + std::string { host } + "]:" + std::to_string(ntohs(m_address.sin6_port));
+    }
+
+private:
+    sockaddr_in6 m_address {};
+};
+
+// The host string is a filesystem path, or a name in the abstract namespace when it starts with '@'. The
+// port is ignored. SO_REUSEPORT does not apply to UNIX sockets, so shards share one listener instead.
+template <>
+class SocketAddress<AF_UNIX> {
+public:
+    static constexpr bool s_REUSE_PORT { false };
+    static constexpr bool s_TCP { false };
+
+    bool parse(char const* host, uint16_t) noexcept
+    {
+        size_t len = std::strlen(host);
+        if (len == 0 || len >= sizeof(m_address.sun_path)) {
+            return false;
+        }
+        m_address.sun_family = AF_UNIX;
+        std::memcpy(m_address.sun_path, host, len);
+        if (host[0] == '@') {
+            m_address.sun_path[0] = '\0';
+        }
+        m_size = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + len);
+        return true;
+    }
+
+    sockaddr const* get() const noexcept { return reinterpret_cast<sockaddr const*>(&m_address); }
+    socklen_t size() const noexcept { return m_size; }
+
+    // A bound pathname socket leaves its file behind; abstract names vanish with the last descriptor.
+    // Anything at the path that is not a socket is left alone, so bind reports it.
+    void unlink() const noexcept
+    {
+        struct stat status;
+        if (m_size > offsetof(sockaddr_un, sun_path) && m_address.sun_path[0] != '\0' && lstat(m_address.sun_path, &status) == 0
+            && S_ISSOCK(status.st_mode)) {
+            ::unlink(m_address.sun_path);
+        }
+    }
+
+    std::string describe() const
+    {
+        size_t len = m_size - offsetof(sockaddr_un, sun_path);
+        if (len > 0 && m_address.sun_path[0] == '\0') {
+            return "unix:@" + std::string { m_address.sun_path + 1, len - 1 };
+        }
+        return "unix:" + std::string { m_address.sun_path, len };
+    }
+
+private:
+    sockaddr_un m_address {};
+    socklen_t m_size {};
+};
+
+#endif
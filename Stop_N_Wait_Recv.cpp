@@ -1,42 +1,144 @@
+#include <algorithm>
 #include <iostream>
+#include <cerrno>
+#include <csignal>
 #include <cstring>
 #include <chrono>
-#include <thread>
 #include <cstdlib>
+#include <memory>
+#include <vector>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
-#define FRAME_SIZE 1024
-#define ACK_SIZE   16   // Length of ACK message (frame number + "ACK")
+#include "Crc32.hpp"
+#include "LinkEmulator.hpp"
 
-void WaitForEvent()
+#define FRAME_SIZE   1024
+#define HEADER_SIZE  2             // Sequence number, big-endian
+#define CRC_SIZE     4             // CRC-32C trailer, as the sender writes it
+#define PAYLOAD_SIZE (FRAME_SIZE - HEADER_SIZE - CRC_SIZE)
+#define ACK_SIZE     12            // "ACK" + sequence number, NUL padded to 8 bytes, then the CRC
+#define SEQ_MODULO   256           // Must match the sender; Selective Repeat needs window <= SEQ_MODULO / 2
+#define READ_SIZE    (64 * 1024)
+#define MAX_OUTBOX   (64 * 1024)   // unsent ACK bytes a session may hold before its sender counts as stuck
+
+using Clock = std::chrono::steady_clock;
+
+// One connected sender with its own Selective Repeat state. Only `window` reorder slots are kept, as a ring
+// whose `head` holds `base`, followed by a staging slot for the frame still being read, so a session costs
+// (window + 1) frames of memory. The table stays dense: closing a session moves the last one into its place,
+// mirroring the poll set behind the listener.
+struct Session {
+    int fd;
+    int id;
+    char peer[INET_ADDRSTRLEN + 8];
+    Clock::time_point start;
+    std::unique_ptr<LinkEmulator> link;   // only when the link is impaired; ACKs go to the outbox otherwise
+    std::vector<char> outbox;             // ACKs the socket has not taken yet, flushed on POLLOUT
+    size_t flushed;                       // bytes of the outbox already written
+    int base;   // sequence number of the next frame to deliver
+    int head;   // reorder slot of base
+    int got;    // bytes of the staged frame read so far
+    long delivered;
+    long duplicates;   // frames from the previous window, re-acknowledged
+    long dropped;      // frames beyond the window
+    long damaged;      // frames whose CRC failed, left for the sender to resend
+    std::vector<bool> present;
+    std::vector<char> frames;
+};
+
+// A closed session whose emulated link still carries ACKs. Its socket stays open until they are due, and the
+// poll loop reaps it then instead of waiting on the delivery thread.
+struct Draining {
+    int fd;
+    std::unique_ptr<LinkEmulator> link;
+};
+
+struct Totals {
+    long delivered;
+    Clock::time_point first;   // first accept
+    Clock::time_point last;    // last close
+};
+
+volatile sig_atomic_t stop_requested = 0;
+
+void RequestStop(int)
 {
-    int wait_time = 500 + std::rand() % 1000;
-    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    stop_requested = 1;
 }
 
-void ReceiveFrame(int connfd, char* frame)
+// Same trailer as the sender writes: the CRC-32C of the rest of the message, in its last CRC_SIZE bytes
+void SealMessage(char* msg, size_t len)
 {
-    std::cout << "Waiting for frame " << std::endl;
-    int n = read(connfd, frame, FRAME_SIZE);
-    if (n < 0) {
-        std::cerr << "Error in receiving frame" << std::endl;
-        exit(EXIT_FAILURE);
+    uint32_t crc = Crc32c(msg, len - CRC_SIZE);
+    for (int byte = 0; byte < CRC_SIZE; ++byte) {
+        msg[len - CRC_SIZE + byte] = static_cast<char>(crc >> (8 * (CRC_SIZE - 1 - byte)));
+    }
+}
+
+bool CheckSeal(char const* msg, size_t len)
+{
+    uint32_t crc = 0;
+    for (int byte = 0; byte < CRC_SIZE; ++byte) {
+        crc = crc << 8 | static_cast<unsigned char>(msg[len - CRC_SIZE + byte]);
+    }
+    return Crc32c(msg, len - CRC_SIZE) == crc;
+}
+
+int FrameSeq(char const* frame)
+{
+    return (static_cast<unsigned char>(frame[0]) << 8 | static_cast<unsigned char>(frame[1])) % SEQ_MODULO;
+}
+
+void SendAck(Session& session, int seq)
+{
+    char ack_msg[ACK_SIZE] {};
+    std::snprintf(ack_msg, ACK_SIZE - CRC_SIZE, "ACK%d", seq);
+    SealMessage(ack_msg, ACK_SIZE);
+    std::cout << "Sending ACK" << seq << std::endl;
+    if (!session.link) {
+        session.outbox.insert(session.outbox.end(), ack_msg, ack_msg + ACK_SIZE);
+    } else if (!session.link->send(ack_msg, ACK_SIZE)) {
+        std::cerr << "Error sending ACK" << std::endl;
     }
-    frame[n] = 0;
 }
 
-void SendAck(int connfd, int frame_number)
+// Writes queued ACKs until the socket would block, so a sender that stops reading them holds up no one else.
+// Returns false once the peer is gone or has left more than MAX_OUTBOX bytes unread.
+bool FlushAcks(Session& session)
 {
-    char ack_msg[ACK_SIZE];
-    std::sprintf(ack_msg, "ACK%d", frame_number);
-    std::cout << "Sending ACK" << frame_number << std::endl;
-    write(connfd, ack_msg, strlen(ack_msg));
+    while (session.flushed < session.outbox.size()) {
+        ssize_t n = send(session.fd, session.outbox.data() + session.flushed, session.outbox.size() - session.flushed, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0) {
+            std::cerr << "Error sending ACK" << std::endl;
+            return false;
+        }
+        session.flushed += n;
+    }
+    if (session.flushed == session.outbox.size()) {
+        session.outbox.clear();
+        session.flushed = 0;
+    }
+    if (session.outbox.size() - session.flushed > MAX_OUTBOX) {
+        std::cerr << "Session " << session.id << " is not reading its ACKs, closing it" << std::endl;
+        return false;
+    }
+    return true;
 }
 
 void ExtractData(char* frame, char* data)
 {
-    strncpy(data, frame, FRAME_SIZE);
+    memcpy(data, frame + HEADER_SIZE, PAYLOAD_SIZE);
+    data[PAYLOAD_SIZE - 1] = '\0';
 }
 
 void DeliverData(char* data)
@@ -44,7 +146,147 @@ void DeliverData(char* data)
     std::cout << "Received frame: " << data << std::endl;
 }
 
-void Receiver(char const* ip, int port, int num_listeners)
+// Selective Repeat receiver: every frame inside [base, base + window) is acknowledged on arrival and buffered,
+// frames are delivered in order as the gap at base fills. Frames from the previous window are re-acknowledged
+// because their ACK was evidently lost. Window size 1 is plain stop-and-wait.
+void AcceptFrame(Session& session, char const* frame, int window)
+{
+    int seq    = FrameSeq(frame);
+    int offset = (seq - session.base + SEQ_MODULO) % SEQ_MODULO;
+    if (offset >= SEQ_MODULO - window) {
+        ++session.duplicates;
+        SendAck(session, seq);
+        return;
+    }
+    if (offset >= window) {
+        std::cerr << "Dropping frame outside the window (session " << session.id << ", seq " << seq << ")" << std::endl;
+        ++session.dropped;
+        return;
+    }
+    int slot = (session.head + offset) % window;
+    if (!session.present[slot]) {
+        session.present[slot] = true;
+        memcpy(&session.frames[slot * FRAME_SIZE], frame, FRAME_SIZE);
+    }
+    char data[FRAME_SIZE];
+    while (session.present[session.head]) {
+        session.present[session.head] = false;
+        ExtractData(&session.frames[session.head * FRAME_SIZE], data);
+        DeliverData(data);
+        ++session.delivered;
+        session.base = (session.base + 1) % SEQ_MODULO;
+        session.head = (session.head + 1) % window;
+    }
+    SendAck(session, seq);
+}
+
+// Frames are fixed-size on a byte stream, so a read may stop mid-frame; the rest is staged until it completes.
+// Returns false once the sender has closed the connection.
+bool ServeSession(Session& session, int window)
+{
+    char buffer[READ_SIZE];
+    ssize_t n = read(session.fd, buffer, READ_SIZE);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        std::cerr << "Error in receiving frame: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (n == 0) {
+        return false;
+    }
+    char* staged = &session.frames[window * FRAME_SIZE];
+    for (ssize_t used = 0; used < n;) {
+        int take = std::min<int>(FRAME_SIZE - session.got, n - used);
+        memcpy(staged + session.got, buffer + used, take);
+        used += take;
+        session.got += take;
+        if (session.got == FRAME_SIZE) {
+            session.got = 0;
+            if (!CheckSeal(staged, FRAME_SIZE)) {
+                std::cerr << "Dropping damaged frame (session " << session.id << ")" << std::endl;
+                ++session.damaged;
+                continue;
+            }
+            AcceptFrame(session, staged, window);
+        }
+    }
+    return true;
+}
+
+// On an impaired link each session draws its own link fate; session 1 keeps the direction a single receiver
+// always used
+void OpenSession(std::vector<Session>& sessions, std::vector<pollfd>& fds, int connfd, sockaddr_in const& cli, int id, int window,
+                 LinkConfig const& link_config)
+{
+    sessions.emplace_back();
+    Session& session = sessions.back();
+    session.fd       = connfd;
+    session.id       = id;
+    session.start    = Clock::now();
+    if (!IsIdealLink(link_config)) {
+        session.link = std::make_unique<LinkEmulator>(connfd, link_config, 2 * id);
+    }
+    session.present.assign(window, false);
+    session.frames.resize((window + 1) * FRAME_SIZE);
+    char host[INET_ADDRSTRLEN] {};
+    inet_ntop(AF_INET, &cli.sin_addr, host, sizeof(host));
+    snprintf(session.peer, sizeof(session.peer), "%s:%d", host, ntohs(cli.sin_port));
+    fds.push_back({ connfd, POLLIN, 0 });
+    std::cout << "Connection established (session " << id << ", " << session.peer << ")." << std::endl;
+}
+
+void CloseSession(std::vector<Session>& sessions, std::vector<pollfd>& fds, std::vector<Draining>& draining, size_t index, Totals& totals)
+{
+    Session& session = sessions[index];
+    if (session.link) {
+        draining.push_back({ session.fd, std::move(session.link) });   // ACKs still in flight are delivered first
+    } else {
+        close(session.fd);
+    }
+
+    auto now       = Clock::now();
+    double seconds = std::chrono::duration<double>(now - session.start).count();
+    double bytes   = static_cast<double>(session.delivered) * PAYLOAD_SIZE;
+    std::cout << "Session " << session.id << " (" << session.peer << "): delivered " << session.delivered << " frames in " << seconds
+              << " s (" << (seconds > 0 ? bytes / seconds / 1e6 : 0) << " MB/s goodput), re-acknowledged " << session.duplicates
+              << " duplicates, dropped " << session.dropped << " frames outside the window and " << session.damaged << " damaged"
+              << std::endl;
+
+    totals.delivered += session.delivered;
+    totals.last = now;
+    if (index + 1 != sessions.size()) {
+        sessions[index] = std::move(sessions.back());
+        fds[index + 1]  = fds.back();
+    }
+    sessions.pop_back();
+    fds.pop_back();
+}
+
+// Closes the sockets of drained sessions whose last ACK is due and returns how long poll may sleep before the
+// next one is, -1 when none is left
+int ReapDraining(std::vector<Draining>& draining)
+{
+    auto now    = Clock::now();
+    int timeout = -1;
+    for (size_t index = draining.size(); index-- > 0;) {
+        Clock::time_point idle_at = draining[index].link->idle_at();
+        if (idle_at <= now) {
+            draining[index].link.reset();   // at most a write still under way
+            close(draining[index].fd);
+            draining[index] = std::move(draining.back());
+            draining.pop_back();
+            continue;
+        }
+        int wait = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(idle_at - now).count());
+        timeout  = timeout < 0 ? wait : std::min(timeout, wait);
+    }
+    return timeout;
+}
+
+// Serves `num_listeners` senders, any number of them at once, from one poll loop; 0 serves until interrupted
+void Receiver(char const* ip, int port, int num_listeners, int window, LinkConfig const& link_config)
 {
     int sockfd, connfd;
     struct sockaddr_in servaddr, cli;
@@ -68,49 +310,113 @@ void Receiver(char const* ip, int port, int num_listeners)
         exit(EXIT_FAILURE);
     }
 
-    if ((listen(sockfd, num_listeners)) != 0) {
+    if ((listen(sockfd, SOMAXCONN)) != 0) {
         std::cerr << "Listen failed." << std::endl;
         exit(EXIT_FAILURE);
     } else {
         std::cout << "Listening for connections..." << std::endl;
     }
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
 
-    socklen_t len = sizeof(cli);
+    struct sigaction action {};
+    action.sa_handler = RequestStop;   // no SA_RESTART, so poll returns and the totals still get printed
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
 
-    connfd = accept(sockfd, (struct sockaddr*)&cli, &len);
-    if (connfd < 0) {
-        std::cerr << "Server accept failed." << std::endl;
-        exit(EXIT_FAILURE);
-    } else {
-        std::cout << "Connection established." << std::endl;
-    }
+    std::vector<Session> sessions;
+    std::vector<pollfd> fds { { sockfd, POLLIN, 0 } };   // listener, then one entry per session in table order
+    std::vector<Draining> draining;
+    Totals totals {};
+    int accepted = 0;
+    int timeout  = -1;
 
-    char frame[FRAME_SIZE];
-    char data[FRAME_SIZE];
+    while (!stop_requested && (num_listeners == 0 || accepted < num_listeners || !sessions.empty() || !draining.empty())) {
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Poll failed: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
 
-    for (int i = 0;; ++i) {
-        ReceiveFrame(connfd, frame);
-        if (!frame[0]) break;
-        ExtractData(frame, data);
-        DeliverData(data);
-        SendAck(connfd, i);
+        // Backwards, so the session moved into a closed one's place has already been served. ACKs a read
+        // produced go out in one write once the whole read is handled.
+        for (size_t index = sessions.size(); index-- > 0;) {
+            short revents = fds[index + 1].revents;
+            if (revents == 0) {
+                continue;
+            }
+            bool alive = (revents & ~POLLOUT) == 0 || ServeSession(sessions[index], window);
+            if (!alive || !FlushAcks(sessions[index])) {
+                CloseSession(sessions, fds, draining, index, totals);
+                continue;
+            }
+            fds[index + 1].events = sessions[index].outbox.empty() ? POLLIN : POLLIN | POLLOUT;
+        }
+
+        while ((fds[0].revents & POLLIN) && (num_listeners == 0 || accepted < num_listeners)) {
+            socklen_t len = sizeof(cli);
+            connfd        = accept4(sockfd, (struct sockaddr*)&cli, &len, SOCK_NONBLOCK);
+            if (connfd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    std::cerr << "Server accept failed." << std::endl;
+                }
+                break;
+            }
+            int nodelay = 1;   // ACKs go out as soon as they are written, not behind Nagle
+            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            if (accepted++ == 0) {
+                totals.first = Clock::now();
+            }
+            OpenSession(sessions, fds, connfd, cli, accepted, window, link_config);
+        }
+        if (num_listeners != 0 && accepted == num_listeners) {
+            fds[0].fd = -1;   // poll skips negative descriptors; later senders wait in the backlog until exit
+        }
+        timeout = ReapDraining(draining);
     }
 
-    close(connfd);
+    while (!sessions.empty()) {
+        CloseSession(sessions, fds, draining, sessions.size() - 1, totals);
+    }
+    for (Draining& entry : draining) {
+        entry.link.reset();
+        close(entry.fd);
+    }
     close(sockfd);
+
+    double seconds = std::chrono::duration<double>(totals.last - totals.first).count();
+    double bytes   = static_cast<double>(totals.delivered) * PAYLOAD_SIZE;
+    std::cout << "All sessions: " << accepted << " served, " << totals.delivered << " frames delivered in " << seconds << " s ("
+              << (seconds > 0 ? bytes / seconds / 1e6 : 0) << " MB/s aggregate goodput)" << std::endl;
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <IP> <Port> <NumListeners>" << std::endl;
+    LinkConfig link_config = ExtractLinkConfig(argc, argv);
+    if (argc != 4 && argc != 5) {
+        std::cerr << "Usage: " << argv[0] << " <IP> <Port> <NumListeners> [Window] [--link latency=MS,jitter=MS,rate=KBPS,loss=P,dup=P,reorder=P,corrupt=P,seed=N]" << std::endl;
+        std::cerr << "NumListeners is the number of senders to serve, concurrently or not; 0 serves until interrupted" << std::endl;
         return EXIT_FAILURE;
     }
 
     char const* ip    = argv[1];
     int port          = std::stoi(argv[2]);
     int num_listeners = std::stoi(argv[3]);
+    int window        = argc > 4 ? std::stoi(argv[4]) : 1;
+
+    if (num_listeners < 0) {
+        std::cerr << "NumListeners must not be negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (window < 1 || window > SEQ_MODULO / 2) {
+        std::cerr << "Window must be between 1 and " << SEQ_MODULO / 2 << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    Receiver(ip, port, num_listeners);
+    Receiver(ip, port, num_listeners, window, link_config);
     return 0;
 }
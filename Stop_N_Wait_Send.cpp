@@ -1,60 +1,189 @@
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <chrono>
-#include <thread>
+#include <memory>
+#include <vector>
+#include <cmath>
 #include <cstdlib>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "Crc32.hpp"
+#include "LinkEmulator.hpp"
+#include "Pacer.hpp"
+#include "TimingWheel.hpp"
+
 #define TOTAL_FRAMES 10
 #define FRAME_SIZE   1024
-#define ACK_SIZE     8   // Length of ACK message (frame number + "ACK")
+#define HEADER_SIZE  2     // Sequence number, big-endian
+#define CRC_SIZE     4     // CRC-32C of everything before it, big-endian, closing every frame and ACK
+#define PAYLOAD_SIZE (FRAME_SIZE - HEADER_SIZE - CRC_SIZE)
+#define ACK_SIZE     12    // "ACK" + sequence number, NUL padded to 8 bytes, then the CRC
+#define SEQ_MODULO   256   // Sequence numbers wrap here; Selective Repeat needs window <= SEQ_MODULO / 2
+
+#define INITIAL_RTO_MS    3000.0
+#define MIN_RTO_MS        200.0
+#define MAX_RTO_MS        60000.0
+#define DUP_ACK_THRESHOLD 3   // ACKs for later frames before the oldest unacknowledged one is resent early
+
+using Clock = std::chrono::steady_clock;
+
+// One slot per sequence number in flight. The window never spans more than SEQ_MODULO / 2
+// numbers, so a sequence number names exactly one outstanding frame.
+struct WindowSlot {
+    bool acked;
+    bool retransmitted;   // Karn: an ACK for this frame cannot be matched to one transmission
+    int later_acks;
+    Clock::time_point sent_at;
+    TimingWheel::TimerId timer;   // retransmission deadline, cancelled by the ACK
+    char frame[FRAME_SIZE];
+};
 
-void WaitForEvent()
+// Jacobson/Karels estimator (RFC 6298)
+struct RtoState {
+    double srtt_ms;
+    double rttvar_ms;
+    double rto_ms;
+    bool has_sample;
+};
+
+struct ArqStats {
+    int retransmissions;
+    int timeouts;
+    int fast_retransmits;
+    int duplicate_acks;
+    int damaged_acks;
+};
+
+void GetData(char* data, int frame_number)
 {
-    int wait_time = 500 + std::rand() % 1000;
-    std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+    snprintf(data, PAYLOAD_SIZE, "Frame %d", frame_number);
 }
 
-void GetData(char* data, int frame_number)
+// Neither frames nor ACKs carry any other integrity check, so a message whose CRC fails is treated as lost
+void SealMessage(char* msg, size_t len)
+{
+    uint32_t crc = Crc32c(msg, len - CRC_SIZE);
+    for (int byte = 0; byte < CRC_SIZE; ++byte) {
+        msg[len - CRC_SIZE + byte] = static_cast<char>(crc >> (8 * (CRC_SIZE - 1 - byte)));
+    }
+}
+
+bool CheckSeal(char const* msg, size_t len)
 {
-    snprintf(data, FRAME_SIZE, "Frame %d", frame_number);
+    uint32_t crc = 0;
+    for (int byte = 0; byte < CRC_SIZE; ++byte) {
+        crc = crc << 8 | static_cast<unsigned char>(msg[len - CRC_SIZE + byte]);
+    }
+    return Crc32c(msg, len - CRC_SIZE) == crc;
 }
 
-void MakeFrame(char* data, char* frame)
+void MakeFrame(char* data, char* frame, int seq)
 {
-    strncpy(frame, data, FRAME_SIZE);
-    frame[FRAME_SIZE - 1] = '\0';   // Ensure null-termination
+    frame[0] = static_cast<char>((seq >> 8) & 0xFF);
+    frame[1] = static_cast<char>(seq & 0xFF);
+    size_t len = strnlen(data, PAYLOAD_SIZE - 1);
+    memcpy(frame + HEADER_SIZE, data, len);
+    memset(frame + HEADER_SIZE + len, 0, PAYLOAD_SIZE - len);   // slots are reused, so no stale tail goes out
+    frame[HEADER_SIZE + PAYLOAD_SIZE - 1] = '\0';   // Ensure null-termination
+    SealMessage(frame, FRAME_SIZE);
 }
 
-void SendFrame(int sockfd, char* frame, int frame_number)
+bool ReadAll(int sockfd, char* data, size_t len)
 {
-    std::cout << "Sending frame " << frame_number << ": " << frame << std::endl;
-    std::cout << "Waiting for ACK " << frame_number << std::endl;
-    WaitForEvent();
-    send(sockfd, frame, FRAME_SIZE, 0);
+    while (len > 0) {
+        ssize_t n = read(sockfd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
 }
 
-void ReceiveAck(int sockfd, int expected_frame_number)
+void SendFrame(LinkEmulator& link, char* frame, int frame_number, int seq)
 {
-    WaitForEvent();
-    char ack_msg[ACK_SIZE];
-    int n = read(sockfd, ack_msg, ACK_SIZE);
-    if (n <= 0) {
-        std::cerr << "Error receiving ACK." << std::endl;
+    std::cout << "Sending frame " << frame_number << " (seq " << seq << "): " << frame + HEADER_SIZE << std::endl;
+    if (!link.send(frame, FRAME_SIZE)) {
+        std::cerr << "Error sending frame." << std::endl;
         exit(EXIT_FAILURE);
     }
-    int ack_frame_number;
-    sscanf(ack_msg, "ACK%d", &ack_frame_number);
-    if (ack_frame_number != expected_frame_number) {
-        std::cerr << "Incorrect ACK received." << std::endl;
-        exit(EXIT_FAILURE);
+}
+
+void SampleRtt(RtoState& rto, double rtt_ms)
+{
+    if (!rto.has_sample) {
+        rto.srtt_ms    = rtt_ms;
+        rto.rttvar_ms  = rtt_ms / 2;
+        rto.has_sample = true;
+    } else {
+        rto.rttvar_ms = 0.75 * rto.rttvar_ms + 0.25 * std::abs(rto.srtt_ms - rtt_ms);
+        rto.srtt_ms   = 0.875 * rto.srtt_ms + 0.125 * rtt_ms;
     }
+    rto.rto_ms = std::clamp(rto.srtt_ms + 4 * rto.rttvar_ms, MIN_RTO_MS, MAX_RTO_MS);
+}
 
-    std::cout << "Received ACK " << expected_frame_number << std::endl;
+void BackoffRto(RtoState& rto)
+{
+    rto.rto_ms = std::min(rto.rto_ms * 2, MAX_RTO_MS);
+}
+
+Clock::time_point Deadline(RtoState const& rto)
+{
+    return Clock::now() + std::chrono::microseconds(static_cast<long long>(rto.rto_ms * 1000));
+}
+
+// Retransmissions are never held back by pacing, but they are charged to the bucket like any other frame
+void Retransmit(LinkEmulator& link, TimingWheel& timers, TokenBucket& pacer, WindowSlot& slot, int frame_number, RtoState const& rto, ArqStats& stats)
+{
+    SendFrame(link, slot.frame, frame_number, frame_number % SEQ_MODULO);
+    pacer.take(FRAME_SIZE);
+    slot.retransmitted = true;
+    timers.cancel(slot.timer);
+    slot.timer = timers.schedule(Deadline(rto), frame_number);
+    ++stats.retransmissions;
+}
+
+// Blocks until at least one ACK arrives, the earliest retransmit deadline passes or pacing lets the next frame
+// go, then drains every ACK already queued. Returns the acknowledged sequence numbers.
+std::vector<int> ReceiveAcks(int sockfd, int64_t timeout_ns, ArqStats& stats)
+{
+    std::vector<int> acks;
+    pollfd pfd { sockfd, POLLIN, 0 };
+    timespec timeout { static_cast<time_t>(timeout_ns / 1000000000), static_cast<long>(timeout_ns % 1000000000) };
+    timespec zero {};
+    while (ppoll(&pfd, 1, acks.empty() ? &timeout : &zero, nullptr) > 0) {
+        char ack_msg[ACK_SIZE + 1] {};
+        if (!ReadAll(sockfd, ack_msg, ACK_SIZE)) {
+            std::cerr << "Error receiving ACK." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (!CheckSeal(ack_msg, ACK_SIZE)) {
+            std::cerr << "Ignoring damaged ACK." << std::endl;
+            ++stats.damaged_acks;
+            continue;
+        }
+        int ack_seq;
+        if (sscanf(ack_msg, "ACK%d", &ack_seq) != 1 || ack_seq < 0 || ack_seq >= SEQ_MODULO) {
+            std::cerr << "Ignoring malformed ACK." << std::endl;
+            continue;
+        }
+        acks.push_back(ack_seq);
+    }
+    return acks;
 }
 
-void Sender(char const* ip, int port)
+// Selective Repeat: up to `window` frames in flight, each acknowledged and retransmitted on its own.
+// Window size 1 is plain stop-and-wait. A frame is resent when its RTO expires, doubling the RTO until
+// a fresh sample arrives, or early once DUP_ACK_THRESHOLD later frames have been acknowledged past it.
+// Deadlines live in a timing wheel, so neither expiry nor the poll timeout scans the window. New frames leave
+// through a token bucket; with AIMD the usable window and the bucket's rate follow the congestion controller.
+void Sender(char const* ip, int port, int window, int total_frames, LinkConfig const& link_config, PacingConfig const& pacing)
 {
     int sockfd;
     struct sockaddr_in servaddr;
@@ -64,6 +193,8 @@ void Sender(char const* ip, int port)
         std::cerr << "Socket creation failed." << std::endl;
         exit(EXIT_FAILURE);
     }
+    int nodelay = 1;   // a window of small frames would otherwise sit behind Nagle and the peer's delayed ACK
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 
     servaddr.sin_family = AF_INET;
     servaddr.sin_port   = htons(port);
@@ -78,30 +209,124 @@ void Sender(char const* ip, int port)
         exit(EXIT_FAILURE);
     }
 
+    auto link = std::make_unique<LinkEmulator>(sockfd, link_config, 1);
     char data[FRAME_SIZE];
-    char frame[FRAME_SIZE];
-    char ack_msg[ACK_SIZE];
+    std::vector<WindowSlot> slots(SEQ_MODULO);
+    int base = 0;   // oldest unacknowledged frame
+    int next = 0;   // next frame to send for the first time
+    RtoState rto { 0, 0, INITIAL_RTO_MS, false };
+    ArqStats stats {};
+    TimingWheel timers;   // cookie is the frame number
+    TokenBucket pacer { pacing.rate_kbps * 1000 / 8, 2 * FRAME_SIZE };
+    AimdController cc { static_cast<double>(window) };
+    auto start = Clock::now();
+
+    while (base < total_frames) {
+        int limit = pacing.aimd ? std::min(window, static_cast<int>(cc.window())) : window;
+        for (; next < base + limit && next < total_frames && pacer.wait_ns(FRAME_SIZE, Clock::now()) == 0; ++next) {
+            WindowSlot& slot = slots[next % SEQ_MODULO];
+            GetData(data, next);
+            MakeFrame(data, slot.frame, next % SEQ_MODULO);
+            SendFrame(*link, slot.frame, next, next % SEQ_MODULO);
+            pacer.take(FRAME_SIZE);
+            slot.acked         = false;
+            slot.retransmitted = false;
+            slot.later_acks    = 0;
+            slot.sent_at       = Clock::now();
+            slot.timer         = timers.schedule(Deadline(rto), next);
+        }
+
+        bool timed_out = false;
+        timers.advance(Clock::now(), [&](uint64_t expired) {
+            int i = static_cast<int>(expired);
+            if (!timed_out) {
+                BackoffRto(rto);   // once per expiry round, not once per frame
+                cc.on_loss(rto.srtt_ms, Clock::now());
+                timed_out = true;
+            }
+            std::cout << "Timeout, resending frame " << i << " (RTO " << rto.rto_ms << " ms)" << std::endl;
+            Retransmit(*link, timers, pacer, slots[i % SEQ_MODULO], i, rto, stats);
+            ++stats.timeouts;
+        });
+
+        int64_t timeout_ns = timers.timeout_ms(Clock::now(), static_cast<int>(rto.rto_ms)) * 1000000LL;
+        if (next < base + limit && next < total_frames) {
+            timeout_ns = std::min(timeout_ns, pacer.wait_ns(FRAME_SIZE, Clock::now()));
+        }
+        for (int ack_seq : ReceiveAcks(sockfd, timeout_ns, stats)) {
+            // Outstanding frames span fewer than SEQ_MODULO / 2 numbers, so the offset from base is unambiguous
+            int frame_number = base + (ack_seq - base % SEQ_MODULO + SEQ_MODULO) % SEQ_MODULO;
+            WindowSlot& slot = slots[ack_seq];
+            if (frame_number >= next || slot.acked) {
+                ++stats.duplicate_acks;
+                continue;
+            }
+            slot.acked = true;
+            timers.cancel(slot.timer);
+            double rtt_ms = -1;
+            if (!slot.retransmitted) {
+                rtt_ms = std::chrono::duration<double, std::milli>(Clock::now() - slot.sent_at).count();
+                SampleRtt(rto, rtt_ms);
+            }
+            if (pacing.aimd && rto.has_sample) {
+                cc.on_ack(rtt_ms, rto.srtt_ms, Clock::now());
+                pacer.set_rate(cc.rate(rto.srtt_ms, FRAME_SIZE), Clock::now());
+            }
+            std::cout << "Received ACK " << frame_number << " (seq " << ack_seq << ")" << std::endl;
 
-    for (int i = 0; i < TOTAL_FRAMES; ++i) {
-        GetData(data, i);
-        MakeFrame(data, frame);
-        SendFrame(sockfd, frame, i);
-        ReceiveAck(sockfd, i);
+            WindowSlot& oldest = slots[base % SEQ_MODULO];
+            if (frame_number > base && !oldest.acked && ++oldest.later_acks == DUP_ACK_THRESHOLD) {
+                std::cout << "Fast retransmit of frame " << base << std::endl;
+                cc.on_loss(rto.srtt_ms, Clock::now());
+                Retransmit(*link, timers, pacer, oldest, base, rto, stats);
+                ++stats.fast_retransmits;
+            }
+        }
+        while (base < next && slots[base % SEQ_MODULO].acked) {
+            ++base;
+        }
     }
 
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Sent " << total_frames << " frames in " << seconds << " s (" << total_frames / seconds
+              << " frames/s) with window " << window << std::endl;
+    std::cout << "Retransmissions " << stats.retransmissions << " (timeouts " << stats.timeouts << ", fast " << stats.fast_retransmits
+              << "), duplicate ACKs " << stats.duplicate_acks << ", damaged ACKs " << stats.damaged_acks << ", SRTT " << rto.srtt_ms << " ms, RTTVAR " << rto.rttvar_ms
+              << " ms, RTO " << rto.rto_ms << " ms" << std::endl;
+    if (pacing.aimd) {
+        std::cout << "AIMD: window " << cc.window() << " frames, min RTT " << cc.min_rtt_ms() << " ms, backed off " << cc.loss_signals()
+                  << " times on loss and " << cc.delay_signals() << " on delay" << std::endl;
+    }
+    if (pacer.rate() > 0) {
+        std::cout << "Pacing: " << pacer.rate() * 8 / 1000 << " kbps at the end, " << total_frames * FRAME_SIZE * 8 / 1000 / seconds
+                  << " kbps achieved" << std::endl;
+    }
+    LinkEmulator::Stats link_stats = link->stats();
+    std::cout << "Link: " << link_stats.sent << " sent, " << link_stats.dropped << " dropped, " << link_stats.duplicated
+              << " duplicated, " << link_stats.reordered << " reordered, " << link_stats.corrupted << " corrupted" << std::endl;
+    link.reset();
     close(sockfd);
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <IP> <Port>" << std::endl;
+    LinkConfig link_config = ExtractLinkConfig(argc, argv);
+    PacingConfig pacing    = ExtractPacingConfig(argc, argv);
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " <IP> <Port> [Window] [Frames] [--rate KBPS] [--aimd] [--link latency=MS,jitter=MS,rate=KBPS,loss=P,dup=P,reorder=P,corrupt=P,seed=N]" << std::endl;
         return EXIT_FAILURE;
     }
 
-    char const* ip = argv[1];
-    int port       = std::stoi(argv[2]);
+    char const* ip   = argv[1];
+    int port         = std::stoi(argv[2]);
+    int window       = argc > 3 ? std::stoi(argv[3]) : 1;
+    int total_frames = argc > 4 ? std::stoi(argv[4]) : TOTAL_FRAMES;
+
+    if (window < 1 || window > SEQ_MODULO / 2) {
+        std::cerr << "Window must be between 1 and " << SEQ_MODULO / 2 << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    Sender(ip, port);
+    Sender(ip, port, window, total_frames, link_config, pacing);
     return 0;
 }
@@ -0,0 +1,246 @@
+#ifndef TIMING_WHEEL
+#define TIMING_WHEEL
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timing wheel (Varghese and Lauck, scheme 7). Four levels of 256 slots cover 2^32 ticks: a timer
+// waits in the level its distance selects and drops one level each time the level below wraps, so schedule and
+// cancel are O(1) and a timer is touched at most once per level before it fires. Timers are intrusive list
+// nodes in one vector, recycled through a free list, so hundreds of thousands of them cost 32 bytes each and
+// no allocation once the vector has grown. Not thread-safe: every reactor thread owns its wheel.
+class TimingWheel {
+public:
+    using Clock   = std::chrono::steady_clock;
+    using TimerId = uint64_t;   // node index in the low half, its generation in the high half
+    static constexpr TimerId s_NONE { 0 };
+
+    explicit TimingWheel(std::chrono::milliseconds tick = std::chrono::milliseconds { 1 }, Clock::time_point now = Clock::now())
+        : m_origin { now }
+        , m_tick { std::max<Clock::duration>(tick, Clock::duration { 1 }) }
+        , m_nodes(s_HEADS)
+    {
+        for (uint32_t head {}; head < s_HEADS; ++head) {
+            m_nodes[head].prev = head;
+            m_nodes[head].next = head;
+        }
+    }
+
+    // on_expire(cookie) runs from the first advance() at or after `deadline`, never before it
+    TimerId schedule(Clock::time_point deadline, uint64_t cookie) noexcept
+    {
+        uint32_t index;
+        if (m_free != s_NIL) {
+            index  = m_free;
+            m_free = m_nodes[index].next;
+        } else {
+            index = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.emplace_back();
+        }
+        Node& node   = m_nodes[index];
+        node.expires = m_ticks_until(deadline);
+        node.cookie  = cookie;
+        m_insert(index);
+        ++m_size;
+        return static_cast<TimerId>(node.gen) << 32 | index;
+    }
+
+    // False when the timer has already fired or been cancelled
+    bool cancel(TimerId timer) noexcept
+    {
+        uint32_t index = static_cast<uint32_t>(timer);
+        if (index < s_HEADS || index >= m_nodes.size() || m_nodes[index].gen != static_cast<uint32_t>(timer >> 32)) {
+            return false;
+        }
+        m_unlink(index);
+        m_release(index);
+        return true;
+    }
+
+    // Fires every timer due by `now`. Callbacks may schedule and cancel freely, including re-arming themselves.
+    template <typename OnExpire>
+    size_t advance(Clock::time_point now, OnExpire&& on_expire) noexcept
+    {
+        uint64_t target = now < m_origin ? 0 : static_cast<uint64_t>((now - m_origin) / m_tick);
+        size_t fired {};
+        while (m_current <= target) {
+            if (m_size == 0) {
+                m_current = target + 1;
+                break;
+            }
+            size_t index = m_current & s_MASK;
+            if (index == 0) {
+                for (size_t level = 1; level < s_LEVELS; ++level) {
+                    size_t slot = (m_current >> (s_BITS * level)) & s_MASK;
+                    m_cascade(level, slot);
+                    if (slot != 0) {
+                        break;
+                    }
+                }
+            }
+            // Empty slots up to the next occupied one or the next wrap are skipped in one step
+            int32_t occupied = m_first_occupied(0, index);
+            uint64_t skip    = (occupied == -1 ? s_SLOTS : static_cast<size_t>(occupied)) - index;
+            if (skip != 0) {
+                m_current = std::min(m_current + skip, target + 1);
+                continue;
+            }
+
+            m_splice(0, index, s_EXPIRING);
+            ++m_current;
+            while (m_nodes[s_EXPIRING].next != s_EXPIRING) {
+                uint32_t expired = m_nodes[s_EXPIRING].next;
+                uint64_t cookie  = m_nodes[expired].cookie;
+                m_unlink(expired);
+                m_release(expired);
+                ++fired;
+                on_expire(cookie);
+            }
+        }
+        return fired;
+    }
+
+    // How long a poll may sleep before the next timer could fire, at most `limit` ms. Without a timer in the
+    // current rotation of the first level this is the next wrap, where later timers cascade down.
+    int32_t timeout_ms(Clock::time_point now, int32_t limit) const noexcept
+    {
+        if (m_size == 0) {
+            return limit;
+        }
+        size_t index     = m_current & s_MASK;
+        int32_t occupied = index == 0 ? 0 : m_first_occupied(0, index);
+        uint64_t tick    = m_current - index + (occupied == -1 ? s_SLOTS : static_cast<size_t>(occupied));
+        auto remaining   = std::chrono::ceil<std::chrono::milliseconds>(m_origin + m_tick * static_cast<int64_t>(tick) - now);
+        return static_cast<int32_t>(std::clamp<int64_t>(remaining.count(), 0, limit < 0 ? INT32_MAX : limit));
+    }
+
+    size_t size() const noexcept { return m_size; }
+
+private:
+    static constexpr size_t s_BITS { 8 };
+    static constexpr size_t s_SLOTS { size_t { 1 } << s_BITS };
+    static constexpr size_t s_MASK { s_SLOTS - 1 };
+    static constexpr size_t s_LEVELS { 4 };
+    static constexpr uint32_t s_EXPIRING { s_LEVELS * s_SLOTS };   // list head for the slot being fired
+    static constexpr uint32_t s_CASCADING { s_EXPIRING + 1 };       // list head for the slot moving down a level
+    static constexpr uint32_t s_HEADS { s_CASCADING + 1 };
+    static constexpr uint32_t s_NIL { UINT32_MAX };
+
+    // List heads occupy the first s_HEADS nodes, so a timer's index is never 0 and no TimerId equals s_NONE
+    struct Node {
+        uint32_t prev { s_NIL };
+        uint32_t next { s_NIL };
+        uint32_t gen { 1 };    // bumped on release, so ids of fired or cancelled timers go stale
+        uint32_t head {};      // list the node is on
+        uint64_t expires {};   // tick
+        uint64_t cookie {};
+    };
+
+    uint64_t m_ticks_until(Clock::time_point deadline) const noexcept
+    {
+        if (deadline <= m_origin) {
+            return 0;
+        }
+        return static_cast<uint64_t>((deadline - m_origin + m_tick - Clock::duration { 1 }) / m_tick);
+    }
+
+    // A timer already due goes into the slot fired next; one further out than the wheel reaches waits in the
+    // last level and re-cascades until it is in range
+    void m_insert(uint32_t index) noexcept
+    {
+        Node& node     = m_nodes[index];
+        uint64_t delta = node.expires < m_current ? 0 : node.expires - m_current;
+        uint64_t when  = m_current + std::min<uint64_t>(delta, (uint64_t { 1 } << (s_BITS * s_LEVELS)) - 1);
+        size_t level {};
+        while (level + 1 < s_LEVELS && delta >= uint64_t { 1 } << (s_BITS * (level + 1))) {
+            ++level;
+        }
+        uint32_t head = static_cast<uint32_t>(level * s_SLOTS + ((when >> (s_BITS * level)) & s_MASK));
+        m_push(head, index);
+        m_occupied[level][(head % s_SLOTS) / 64] |= uint64_t { 1 } << (head % 64);
+    }
+
+    void m_push(uint32_t head, uint32_t index) noexcept
+    {
+        Node& node                       = m_nodes[index];
+        node.head                        = head;
+        node.prev                        = m_nodes[head].prev;
+        node.next                        = head;
+        m_nodes[m_nodes[head].prev].next = index;
+        m_nodes[head].prev               = index;
+    }
+
+    void m_unlink(uint32_t index) noexcept
+    {
+        Node& node              = m_nodes[index];
+        m_nodes[node.prev].next = node.next;
+        m_nodes[node.next].prev = node.prev;
+        if (node.head < s_EXPIRING && m_nodes[node.head].next == node.head) {
+            m_occupied[node.head / s_SLOTS][(node.head % s_SLOTS) / 64] &= ~(uint64_t { 1 } << (node.head % 64));
+        }
+    }
+
+    void m_release(uint32_t index) noexcept
+    {
+        Node& node = m_nodes[index];
+        node.gen   = node.gen + 1 == 0 ? 1 : node.gen + 1;
+        node.next  = m_free;
+        m_free     = index;
+        --m_size;
+    }
+
+    // Moves a whole slot onto one of the private list heads, which are empty between calls
+    void m_splice(size_t level, size_t slot, uint32_t to) noexcept
+    {
+        uint32_t from = static_cast<uint32_t>(level * s_SLOTS + slot);
+        if (m_nodes[from].next == from) {
+            return;
+        }
+        for (uint32_t index = m_nodes[from].next; index != from; index = m_nodes[index].next) {
+            m_nodes[index].head = to;
+        }
+        m_nodes[to].next               = m_nodes[from].next;
+        m_nodes[to].prev               = m_nodes[from].prev;
+        m_nodes[m_nodes[to].next].prev = to;
+        m_nodes[m_nodes[to].prev].next = to;
+        m_nodes[from].next             = from;
+        m_nodes[from].prev             = from;
+        m_occupied[level][slot / 64] &= ~(uint64_t { 1 } << (slot % 64));
+    }
+
+    // Re-files a slot whose timers are now within reach of the levels below. Detaching it first matters for
+    // timers beyond the wheel's range, which land in the last level again.
+    void m_cascade(size_t level, size_t slot) noexcept
+    {
+        m_splice(level, slot, s_CASCADING);
+        while (m_nodes[s_CASCADING].next != s_CASCADING) {
+            uint32_t index = m_nodes[s_CASCADING].next;
+            m_unlink(index);
+            m_insert(index);
+        }
+    }
+
+    int32_t m_first_occupied(size_t level, size_t from) const noexcept
+    {
+        for (size_t word = from / 64; word < s_SLOTS / 64; ++word) {
+            uint64_t bits = m_occupied[level][word] & (word == from / 64 ? ~uint64_t { 0 } << (from % 64) : ~uint64_t { 0 });
+            if (bits != 0) {
+                return static_cast<int32_t>(word * 64 + __builtin_ctzll(bits));
+            }
+        }
+        return -1;
+    }
+
+    Clock::time_point const m_origin;
+    Clock::duration const m_tick;
+    uint64_t m_current {};   // next tick to fire
+    size_t m_size {};
+    uint32_t m_free { s_NIL };
+    std::vector<Node> m_nodes;
+    uint64_t m_occupied[s_LEVELS][s_SLOTS / 64] {};
+};
+
+#endif
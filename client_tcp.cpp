@@ -1,32 +1,45 @@
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <functional>
+#include <queue>
 #include <thread>
 #include <string>
+#include <vector>
 
 #include <arpa/inet.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
-#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "Histogram.hpp"
+#include "Protocol.hpp"
+#include "Reactor.hpp"
+#include "SocketAddress.hpp"
+#include "TimingWheel.hpp"
+
 template <int32_t Domain>
 class Client {
 public:
     int32_t const domain = Domain;
 
-    Client(std::string const& uname) noexcept
+    Client(std::string const& uname, Backend backend = _DEFAULT_BACKEND_, std::chrono::milliseconds heartbeat = {}) noexcept
         : m_uname { std::move(uname) }
         , m_socket { socket(Domain, SOCK_STREAM, 0) }
+        , m_reactor { Reactor::create(backend) }
+        , m_heartbeat { heartbeat }
     {
         if (m_socket == -1) {
             std::fprintf(stderr, "Could not create socket for client : %s\n", m_uname.c_str());
             std::fflush(stderr);
             return;
         }
-        m_pollfd_set[FD_INDEX::STDIN]       = { STDIN_FILENO, POLLIN };
-        m_pollfd_set[FD_INDEX::SERVER_SOCK] = { m_socket, POLLIN };
+        m_reactor->add(STDIN_FILENO, EV_READ);
     }
 
     Client(Client const&)             = delete;
@@ -34,45 +47,57 @@ public:
     Client(Client const&&)            = delete;
     Client& operator=(Client const&&) = delete;
 
-    template <typename SockAddrType>
-    void connect_to(SockAddrType&& server_address) noexcept
+    void connect_to(SocketAddress<Domain> const& server_address) noexcept
     {
-        if (connect(m_socket, reinterpret_cast<sockaddr*>(&server_address), sizeof(SockAddrType)) != -1) {
-            int32_t send_uname = send(m_socket, m_uname.c_str(), m_uname.size(), 0);
-            if (send_uname == -1) {
+        if (connect(m_socket, server_address.get(), server_address.size()) != -1) {
+            size_t uname_size = std::min<size_t>(m_uname.size(), s_MAX_BUFFER_SIZE);
+            EncodeHeader(m_write_buffer.data(), FrameType::HELLO, 0, uname_size);
+            std::memcpy(m_write_buffer.data() + s_FRAME_HEADER_SIZE, m_uname.data(), uname_size);
+            if (!m_send_all(m_write_buffer.data(), s_FRAME_HEADER_SIZE + uname_size)) {
                 std::fputs("Could not send username\n", stderr);
                 std::fflush(stderr);
             }
+            // Completion backends keep a multishot recv armed; readiness backends stay level-triggered since
+            // m_receive_msg reads once per wakeup
+            if (m_reactor->completion_based() ? !m_reactor->add_stream(m_socket) : !m_reactor->add(m_socket, EV_READ)) {
+                std::fprintf(stderr, "Could not register connection with %s\n", m_reactor->name());
+                std::fflush(stderr);
+            }
             std::fputs("Connection established\n", stdout);
             std::fflush(stdout);
             return;
         }
-        std::fprintf(stderr,
-                     "Could not connect to server IP : %s PORT : %hu\n",
-                     inet_ntop(AF_INET, &server_address.sin_addr, m_read_buffer.data(), INET_ADDRSTRLEN),
-                     ntohs(server_address.sin_port));
+        std::fprintf(stderr, "Could not connect to server %s\n", server_address.describe().c_str());
         std::fflush(stderr);
         return;
     }
 
     void communicate(int32_t tout_in_mill = 1000)
     {
-        for (int32_t poll_stat; !m_close_conn;) {
-            poll_stat = poll(m_pollfd_set.data(), m_pollfd_set.size(), tout_in_mill);
-            if (poll_stat == -1) {
+        m_last_heard = m_last_sent = TimingWheel::Clock::now();
+        m_arm_heartbeat();
+        while (!m_close_conn) {
+            if (m_reactor->wait(m_timers.timeout_ms(TimingWheel::Clock::now(), tout_in_mill)) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 std::fprintf(stderr, "Polling failed\n");
                 std::fflush(stderr);
                 return;
             }
-            if (poll_stat > 0) {
-                if (m_pollfd_set[STDIN_FILENO].revents & POLLIN) {
-                    m_send_msg();
-                    continue;
+            for (ReactorEvent const& event : *m_reactor) {
+                if (m_close_conn) {
+                    break;
                 }
-                if (m_pollfd_set[FD_INDEX::SERVER_SOCK].revents & POLLIN) {
+                if (event.fd == STDIN_FILENO) {
+                    m_send_msg();
+                } else if (event.flags & EV_DATA) {
+                    m_on_data(event.data, event.result);
+                } else {
                     m_receive_msg();
                 }
             }
+            m_timers.advance(TimingWheel::Clock::now(), [this](uint64_t) { m_on_heartbeat(); });
         }
     }
 
@@ -84,26 +109,73 @@ public:
     }
 
 private:
+    // One recv can hold several frames or a fragment of one; print every frame that is complete
     void m_receive_msg() noexcept
     {
-        int32_t read_bytes = recv(m_socket, m_read_buffer.data(), s_MAX_BUFFER_SIZE, 0);
+        ssize_t read_bytes = m_parser.fill(m_socket);
         if (read_bytes == -1) {
             std::fputs("Could not receive complete message\n", stderr);
             std::fflush(stderr);
+            return;
         } else if (read_bytes == 0) {
             std::fputs("Server closed connection\n", stdout);
             std::fflush(stdout);
             m_close_conn = true;
             return;
         }
-        std::fwrite(m_read_buffer.data(), sizeof(char), read_bytes, stdout);
+        m_print_frames();
+    }
+
+    // Completion path: the reactor already received `result` bytes into one of its buffers
+    void m_on_data(char const* data, int32_t result) noexcept
+    {
+        if (result < 0) {
+            std::fputs("Could not receive complete message\n", stderr);
+            std::fflush(stderr);
+            m_close_conn = true;
+            return;
+        } else if (result == 0) {
+            std::fputs("Server closed connection\n", stdout);
+            std::fflush(stdout);
+            m_close_conn = true;
+            return;
+        }
+        for (size_t fed {}; fed < static_cast<size_t>(result) && !m_close_conn;) {
+            fed += m_parser.feed(data + fed, result - fed);
+            m_print_frames();
+        }
+    }
+
+    void m_print_frames() noexcept
+    {
+        FrameHeader header;
+        char const* payload;
+        m_last_heard = TimingWheel::Clock::now();
+        while (m_parser.next(header, payload)) {
+            if (header.type == FrameType::PING) {
+                m_send_control(FrameType::PONG);
+                continue;
+            }
+            if (header.type == FrameType::PONG) {
+                continue;
+            }
+            if (header.topic != 0) {
+                std::fprintf(stdout, "#%hu ", header.topic);
+            }
+            std::fwrite(payload, sizeof(char), header.length, stdout);
+        }
         std::fflush(stdout);
+        if (m_parser.error()) {
+            std::fputs("Malformed frame from server\n", stderr);
+            std::fflush(stderr);
+            m_close_conn = true;
+        }
     }
 
     void m_send_msg() noexcept
     {
-        int32_t send_bytes         = read(STDIN_FILENO, m_write_buffer.data(), s_MAX_BUFFER_SIZE);
-        m_write_buffer[send_bytes] = 0;
+        char* line         = m_write_buffer.data() + s_FRAME_HEADER_SIZE;
+        int32_t send_bytes = read(STDIN_FILENO, line, s_MAX_BUFFER_SIZE);
 
         if (send_bytes == -1) {
             std::fputs("Could not send message\n", stderr);
@@ -111,48 +183,553 @@ private:
             return;
         }
 
-        if (m_write_buffer[0] == '0') {
+        if (send_bytes == 0 || line[0] == '0') {
             std::fputs("Closing connection\n", stdout);
             std::fflush(stdout);
             m_close_conn = true;
             return;
         }
 
-        send(m_socket, m_write_buffer.data(), send_bytes, 0);
+        if (line[0] == '/') {
+            m_command(line, send_bytes);
+            return;
+        }
+
+        EncodeHeader(m_write_buffer.data(), FrameType::CHAT, 0, send_bytes, m_topic);
+        if (!m_send_all(m_write_buffer.data(), s_FRAME_HEADER_SIZE + send_bytes)) {
+            std::fputs("Could not send message\n", stderr);
+            std::fflush(stderr);
+        }
+    }
+
+    // "/join N" and "/leave N" change subscriptions, "/room N" picks the topic later lines are sent to
+    void m_command(char* line, int32_t len) noexcept
+    {
+        line[std::min<int32_t>(len, s_MAX_BUFFER_SIZE - 1)] = '\0';
+        char* arg                                            = std::strchr(line, ' ');
+        char* end                                            = nullptr;
+        unsigned long topic                                  = arg != nullptr ? std::strtoul(arg + 1, &end, 10) : 0;
+        if (arg == nullptr || end == arg + 1 || topic > UINT16_MAX) {
+            std::fputs("Usage: /join N, /leave N or /room N with N in 0..65535\n", stderr);
+            std::fflush(stderr);
+            return;
+        }
+        FrameType type;
+        if (std::strncmp(line, "/join ", 6) == 0) {
+            type = FrameType::JOIN;
+        } else if (std::strncmp(line, "/leave ", 7) == 0) {
+            type = FrameType::LEAVE;
+        } else if (std::strncmp(line, "/room ", 6) == 0) {
+            m_topic = static_cast<uint16_t>(topic);
+            return;
+        } else {
+            std::fprintf(stderr, "Unknown command %s", line);
+            std::fflush(stderr);
+            return;
+        }
+        char frame[s_FRAME_HEADER_SIZE];
+        EncodeHeader(frame, type, 0, 0, static_cast<uint16_t>(topic));
+        if (!m_send_all(frame, sizeof(frame))) {
+            std::fputs("Could not send command\n", stderr);
+            std::fflush(stderr);
+        }
+    }
+
+    void m_send_control(FrameType type) noexcept
+    {
+        char frame[s_FRAME_HEADER_SIZE];
+        EncodeHeader(frame, type, 0, 0);
+        if (!m_send_all(frame, sizeof(frame))) {
+            std::fputs("Could not send heartbeat\n", stderr);
+            std::fflush(stderr);
+        }
+    }
+
+    // With --heartbeat the client PINGs a quiet connection every interval and gives up on a server that has
+    // said nothing for s_MISSED_HEARTBEATS of them; the deadline is only recomputed when the timer fires
+    void m_arm_heartbeat() noexcept
+    {
+        if (m_heartbeat.count() > 0) {
+            m_timers.schedule(std::min(m_last_sent + m_heartbeat, m_last_heard + m_heartbeat * s_MISSED_HEARTBEATS), 0);
+        }
+    }
+
+    void m_on_heartbeat() noexcept
+    {
+        auto now = TimingWheel::Clock::now();
+        if (now - m_last_heard >= m_heartbeat * s_MISSED_HEARTBEATS) {
+            std::fputs("Server stopped responding\n", stdout);
+            std::fflush(stdout);
+            m_close_conn = true;
+            return;
+        }
+        if (now - m_last_sent >= m_heartbeat) {
+            m_send_control(FrameType::PING);
+        }
+        m_arm_heartbeat();
+    }
+
+    bool m_send_all(char const* data, size_t len) noexcept
+    {
+        m_last_sent = TimingWheel::Clock::now();
+        while (len > 0) {
+            ssize_t send_bytes = send(m_socket, data, len, MSG_NOSIGNAL);
+            if (send_bytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += send_bytes;
+            len -= send_bytes;
+        }
+        return true;
     }
 
 public:
     static constexpr uint16_t s_MAX_BUFFER_SIZE { 1024 };
-    static constexpr uint16_t s_EXTRA_BUFFER_SIZE { 256 };
+    static constexpr int32_t s_MISSED_HEARTBEATS { 3 };
 
 private:
-    enum FD_INDEX {
-        STDIN,
-        SERVER_SOCK
-    };
     std::string const m_uname;
     int32_t const m_socket;
     bool m_close_conn {};
-    std::array<pollfd, 2> m_pollfd_set;
-    std::array<char, s_MAX_BUFFER_SIZE + 1 + s_EXTRA_BUFFER_SIZE> m_read_buffer {};
-    std::array<char, s_MAX_BUFFER_SIZE + 1 + s_EXTRA_BUFFER_SIZE> m_write_buffer {};
+    uint16_t m_topic {};   // where chat lines go, see m_command
+    std::unique_ptr<Reactor> m_reactor;
+    std::chrono::milliseconds const m_heartbeat;
+    TimingWheel m_timers;
+    TimingWheel::Clock::time_point m_last_heard;
+    TimingWheel::Clock::time_point m_last_sent;
+    FrameParser m_parser;
+    std::array<char, s_FRAME_HEADER_SIZE + s_MAX_BUFFER_SIZE> m_write_buffer {};
+};
+
+struct LoadOptions {
+    uint32_t users { 1000 };
+    double rate { 1.0 };   // messages per second per user
+    uint32_t size { 64 };
+    uint32_t duration { 10 };   // seconds of sending, followed by a short drain
 };
 
+// Drives many simulated chat users from one readiness reactor thread. Each user sends `size`-byte messages
+// at `rate` per second, open loop, carrying its index and send time. Every broadcast that comes back is
+// matched against that timestamp, so the histograms hold end-to-end fan-out latency over all receivers.
+class LoadGenerator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    LoadGenerator(std::string const& uname, LoadOptions const& options, Backend backend) noexcept
+        : m_uname { uname }
+        , m_options { options }
+        , m_reactor { Reactor::create(backend) }
+        , m_interval_ns { static_cast<uint64_t>(1e9 / std::max(options.rate, 1e-3)) }
+    {
+        m_options.size = std::clamp<uint32_t>(m_options.size, s_MIN_SIZE, s_MAX_PAYLOAD - s_SERVER_PREFIX);
+    }
+
+    LoadGenerator(LoadGenerator const&)            = delete;
+    LoadGenerator& operator=(LoadGenerator const&) = delete;
+
+    ~LoadGenerator() noexcept
+    {
+        for (User const& user : m_users) {
+            if (user.fd != -1) {
+                close(user.fd);
+            }
+        }
+    }
+
+    // Connects and greets every user, then waits for the server to register them all: each pair of users
+    // produces exactly one "connected" notice, to whichever registered first
+    template <int32_t Domain>
+    bool connect_to(SocketAddress<Domain> const& server_address) noexcept
+    {
+        m_users.reserve(m_options.users);
+        for (uint32_t index {}; index < m_options.users; ++index) {
+            int32_t fd = socket(Domain, SOCK_STREAM, 0);
+            if (fd == -1 || connect(fd, server_address.get(), server_address.size()) != 0) {
+                std::fprintf(stderr, "Could not connect user %u: %s\n", index, std::strerror(errno));
+                std::fflush(stderr);
+                if (fd != -1) {
+                    close(fd);
+                }
+                return false;
+            }
+            std::string name = m_uname + std::to_string(index);
+            char hello[s_FRAME_HEADER_SIZE + 64];
+            size_t len = std::min<size_t>(name.size(), 64);
+            EncodeHeader(hello, FrameType::HELLO, 0, len);
+            std::memcpy(hello + s_FRAME_HEADER_SIZE, name.data(), len);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            m_users.emplace_back(fd);
+            m_users.back().outbound.assign(hello, s_FRAME_HEADER_SIZE + len);
+            if (static_cast<size_t>(fd) >= m_user_of_fd.size()) {
+                m_user_of_fd.resize(fd + 1, -1);
+            }
+            m_user_of_fd[fd] = static_cast<int32_t>(index);
+            ++m_open;
+            if (!m_reactor->add(fd, EV_READ) || !m_flush(index)) {
+                std::fprintf(stderr, "Could not register user %u with %s\n", index, m_reactor->name());
+                std::fflush(stderr);
+                return false;
+            }
+            // Early users collect a notice per later one; keep them read so the server never sees a slow consumer
+            if (index % 64 == 63) {
+                m_poll(0);
+            }
+        }
+
+        uint64_t pairs = static_cast<uint64_t>(m_options.users) * (m_options.users - 1) / 2;
+        auto deadline  = Clock::now() + std::chrono::seconds(30);
+        while (m_notices < pairs && Clock::now() < deadline && m_poll(100)) {
+        }
+        if (m_notices < pairs) {
+            std::fprintf(stderr, "Only %llu of %llu connect notices arrived; fan-out counts will be low\n",
+                         static_cast<unsigned long long>(m_notices), static_cast<unsigned long long>(pairs));
+            std::fflush(stderr);
+        }
+        std::fprintf(stdout, "%u users connected using %s\n", m_options.users, m_reactor->name());
+        std::fflush(stdout);
+        return true;
+    }
+
+    void run() noexcept
+    {
+        uint64_t start = s_now();
+        for (uint32_t index {}; index < m_users.size(); ++index) {
+            m_schedule.push({ start + m_interval_ns * index / m_users.size(), index });   // spread the first sends
+        }
+        uint64_t stop   = start + m_options.duration * 1000000000ULL;
+        uint64_t report = start + 1000000000ULL;
+        m_window_start  = start;
+
+        for (uint64_t now = start; now < stop; now = s_now()) {
+            while (!m_schedule.empty() && m_schedule.top().first <= now) {
+                auto [due, index] = m_schedule.top();
+                m_schedule.pop();
+                m_send(index);
+                // Open loop: a generator that fell a whole interval behind skips ahead rather than bursting
+                uint64_t next = due + m_interval_ns;
+                if (next + m_interval_ns < now) {
+                    ++m_late;
+                    next = now;
+                }
+                m_schedule.push({ next, index });
+            }
+            if (now >= report) {
+                m_report(now, m_window, "");
+                m_window = {};
+                report += 1000000000ULL;
+            }
+            uint64_t wake = std::min(report, m_schedule.empty() ? stop : m_schedule.top().first);
+            if (!m_poll(wake > now ? static_cast<int32_t>((wake - now + 999999) / 1000000) : 0)) {
+                break;
+            }
+        }
+
+        // Let broadcasts still in flight arrive before counting what is missing
+        uint64_t drain = s_now() + 1000000000ULL;
+        while (m_total.deliveries < m_total.sent * (m_users.size() - 1) && s_now() < drain && m_poll(10)) {
+        }
+        m_window_start = start;
+        m_report(s_now(), m_total, "total ");
+    }
+
+private:
+    static constexpr uint32_t s_MIN_SIZE { 32 };
+    static constexpr uint32_t s_SERVER_PREFIX { 96 };   // "Message from [name]: " added by the server
+    static constexpr size_t s_MAX_OUTBOUND { 64 * 1024 };
+
+    struct User {
+        explicit User(int32_t fd) noexcept
+            : fd { fd }
+            , parser { 64 * 1024 }
+        {
+        }
+
+        int32_t fd;
+        FrameParser parser;
+        std::string outbound;   // bytes the socket would not take yet
+        bool writable_armed {};
+    };
+
+    struct Stats {
+        uint64_t sent {};
+        uint64_t deliveries {};
+        uint64_t skipped {};   // messages not sent because the user's socket stayed full
+        Histogram latency;
+    };
+
+    static uint64_t s_now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Returns false once the reactor fails or every user is gone
+    bool m_poll(int32_t timeout) noexcept
+    {
+        if (m_reactor->wait(timeout) == -1 && errno != EINTR) {
+            std::fprintf(stderr, "Polling failed\n");
+            std::fflush(stderr);
+            return false;
+        }
+        for (ReactorEvent const& event : *m_reactor) {
+            int32_t index = event.fd < static_cast<int32_t>(m_user_of_fd.size()) ? m_user_of_fd[event.fd] : -1;
+            if (index == -1) {
+                continue;
+            }
+            if (event.flags & EV_WRITE) {
+                m_flush(index);
+            }
+            if (event.flags & (EV_READ | EV_HANGUP | EV_ERROR)) {
+                m_receive(index);
+            }
+        }
+        return m_open > 0;
+    }
+
+    void m_send(uint32_t index) noexcept
+    {
+        User& user = m_users[index];
+        if (user.fd == -1) {
+            return;
+        }
+        if (user.outbound.size() > s_MAX_OUTBOUND) {
+            ++m_window.skipped;
+            ++m_total.skipped;
+            return;
+        }
+        char frame[s_FRAME_HEADER_SIZE + s_MAX_PAYLOAD];
+        char* payload = frame + s_FRAME_HEADER_SIZE;
+        int32_t len   = std::snprintf(payload, m_options.size + 1, "%u %llu ", index, static_cast<unsigned long long>(s_now()));
+        std::memset(payload + len, 'x', m_options.size - len);
+        EncodeHeader(frame, FrameType::CHAT, 0, m_options.size);
+        user.outbound.append(frame, s_FRAME_HEADER_SIZE + m_options.size);
+        ++m_window.sent;
+        ++m_total.sent;
+        m_flush(index);
+    }
+
+    bool m_flush(uint32_t index) noexcept
+    {
+        User& user = m_users[index];
+        size_t written {};
+        while (written < user.outbound.size()) {
+            ssize_t sent = ::send(user.fd, user.outbound.data() + written, user.outbound.size() - written, MSG_NOSIGNAL);
+            if (sent == -1 && errno == EINTR) {
+                continue;
+            }
+            if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent == -1) {
+                m_drop(index);
+                return false;
+            }
+            written += sent;
+        }
+        user.outbound.erase(0, written);
+        bool want_write = !user.outbound.empty();
+        if (want_write != user.writable_armed) {
+            user.writable_armed = want_write;
+            m_reactor->modify(user.fd, want_write ? EV_READ | EV_WRITE : EV_READ);
+        }
+        return true;
+    }
+
+    void m_receive(uint32_t index) noexcept
+    {
+        User& user = m_users[index];
+        for (;;) {
+            ssize_t read_bytes = user.fd == -1 ? 0 : user.parser.fill(user.fd);
+            if (read_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (read_bytes <= 0 && !(read_bytes == -1 && errno == EINTR)) {
+                m_drop(index);
+                return;
+            }
+            FrameHeader header;
+            char const* payload;
+            while (user.parser.next(header, payload)) {
+                if (header.type == FrameType::NOTICE) {
+                    ++m_notices;
+                } else if (header.type == FrameType::CHAT) {
+                    m_match(payload, header.length);
+                } else if (header.type == FrameType::PING) {
+                    char pong[s_FRAME_HEADER_SIZE];
+                    EncodeHeader(pong, FrameType::PONG, 0, 0);
+                    user.outbound.append(pong, sizeof(pong));
+                    m_flush(index);
+                }
+            }
+            if (user.parser.error()) {
+                m_drop(index);
+                return;
+            }
+        }
+    }
+
+    void m_match(char const* payload, uint32_t length) noexcept
+    {
+        char const* body = static_cast<char const*>(memmem(payload, length, "]: ", 3));
+        if (body == nullptr) {
+            return;
+        }
+        char text[48] {};
+        std::memcpy(text, body + 3, std::min<size_t>(sizeof(text) - 1, payload + length - body - 3));
+        char* end;
+        unsigned long sender    = std::strtoul(text, &end, 10);
+        unsigned long long sent = std::strtoull(end, &end, 10);
+        if (sent == 0 || sender >= m_users.size()) {
+            return;
+        }
+        uint64_t latency = s_now() - sent;
+        m_window.latency.record(latency);
+        m_total.latency.record(latency);
+        ++m_window.deliveries;
+        ++m_total.deliveries;
+    }
+
+    void m_drop(uint32_t index) noexcept
+    {
+        User& user = m_users[index];
+        if (user.fd == -1) {
+            return;
+        }
+        std::fprintf(stderr, "User %u lost its connection\n", index);
+        std::fflush(stderr);
+        m_reactor->remove(user.fd);
+        m_user_of_fd[user.fd] = -1;
+        close(user.fd);
+        user.fd = -1;
+        --m_open;
+    }
+
+    void m_report(uint64_t now, Stats const& stats, char const* label) noexcept
+    {
+        double seconds    = (now - m_window_start) / 1e9;
+        uint64_t expected = stats.sent * (m_users.size() - 1);
+        m_window_start    = now;
+        std::fprintf(stdout,
+                     "%susers %d | sent %.0f msg/s | fan-out %.0f deliveries/s (%.2f%% of expected) | latency us p50 %.1f"
+                     " p99 %.1f p99.9 %.1f max %.1f | skipped %llu late %llu\n",
+                     label,
+                     m_open,
+                     stats.sent / seconds,
+                     stats.deliveries / seconds,
+                     expected ? 100.0 * stats.deliveries / expected : 100.0,
+                     stats.latency.percentile(0.50) / 1e3,
+                     stats.latency.percentile(0.99) / 1e3,
+                     stats.latency.percentile(0.999) / 1e3,
+                     stats.latency.max() / 1e3,
+                     static_cast<unsigned long long>(stats.skipped),
+                     static_cast<unsigned long long>(m_late));
+        std::fflush(stdout);
+    }
+
+    std::string const m_uname;
+    LoadOptions m_options;
+    std::unique_ptr<Reactor> m_reactor;
+    uint64_t const m_interval_ns;
+    std::vector<User> m_users;
+    std::vector<int32_t> m_user_of_fd;
+    std::priority_queue<std::pair<uint64_t, uint32_t>, std::vector<std::pair<uint64_t, uint32_t>>, std::greater<>> m_schedule;
+    int32_t m_open {};
+    uint64_t m_notices {};
+    uint64_t m_late {};
+    uint64_t m_window_start {};
+    Stats m_window;
+    Stats m_total;
+};
+
+void RaiseFdLimit() noexcept
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+template <int32_t Domain>
+void Run(char const* host, uint16_t port, char const* uname, Backend backend, bool load_mode, LoadOptions const& load, std::chrono::milliseconds heartbeat) noexcept
+{
+    SocketAddress<Domain> server_address;
+    if (!server_address.parse(host, port)) {
+        std::fprintf(stderr, "Invalid server address %s\n", host);
+        std::exit(64);
+    }
+
+    if (load_mode) {
+        // The generator owns its sockets' I/O, which a completion backend would take over
+        if (backend == Backend::IO_URING) {
+            backend = Backend::EPOLL;
+        }
+        if (load.users < 2) {
+            std::fprintf(stderr, "--load needs at least 2 users to measure fan-out\n");
+            std::exit(64);
+        }
+        RaiseFdLimit();
+        LoadGenerator generator { uname, load, backend };
+        if (!generator.connect_to(server_address)) {
+            std::exit(EXIT_FAILURE);
+        }
+        generator.run();
+        return;
+    }
+
+    Client<Domain> c { uname, backend, heartbeat };
+    c.connect_to(server_address);
+    c.communicate();
+}
+
 int32_t main(int32_t argc, char** argv)
 {
 
-    if (argc != 4) {
-        std::fprintf(stderr, "Usage: %s <IP> <PORT> <UNAME>\n", argv[0]);
+    if (argc < 4 || argc % 2 != 0) {
+        std::fprintf(stderr,
+                     "Usage: %s <IPv4 | IPv6 | unix:PATH | unix:@NAME> <PORT> <UNAME> [--backend poll|epoll|io_uring]"
+                     " [--heartbeat MS] [--load USERS [--rate MSG_PER_SEC] [--size BYTES] [--duration SECONDS]]\n",
+                     argv[0]);
         std::fflush(stderr);
         std::exit(64);
     }
 
-    sockaddr_in server_address;
-    server_address.sin_family = AF_INET;
-    inet_pton(AF_INET, argv[1], &server_address.sin_addr);
-    server_address.sin_port = htons(std::stoul(argv[2]));
+    Backend backend = _DEFAULT_BACKEND_;
+    LoadOptions load;
+    bool load_mode = false;
+    std::chrono::milliseconds heartbeat {};
+    for (int32_t arg = 4; arg < argc; arg += 2) {
+        if (std::strcmp(argv[arg], "--backend") == 0 && std::strcmp(argv[arg + 1], "poll") == 0) {
+            backend = Backend::POLL;
+        } else if (std::strcmp(argv[arg], "--backend") == 0 && std::strcmp(argv[arg + 1], "epoll") == 0) {
+            backend = Backend::EPOLL;
+        } else if (std::strcmp(argv[arg], "--backend") == 0 && std::strcmp(argv[arg + 1], "io_uring") == 0) {
+            backend = Backend::IO_URING;
+        } else if (std::strcmp(argv[arg], "--heartbeat") == 0) {
+            heartbeat = std::chrono::milliseconds { std::stoul(argv[arg + 1]) };
+        } else if (std::strcmp(argv[arg], "--load") == 0) {
+            load.users = static_cast<uint32_t>(std::stoul(argv[arg + 1]));
+            load_mode  = true;
+        } else if (std::strcmp(argv[arg], "--rate") == 0) {
+            load.rate = std::stod(argv[arg + 1]);
+        } else if (std::strcmp(argv[arg], "--size") == 0) {
+            load.size = static_cast<uint32_t>(std::stoul(argv[arg + 1]));
+        } else if (std::strcmp(argv[arg], "--duration") == 0) {
+            load.duration = static_cast<uint32_t>(std::stoul(argv[arg + 1]));
+        } else {
+            std::fprintf(stderr, "Unknown option %s %s\n", argv[arg], argv[arg + 1]);
+            std::exit(64);
+        }
+    }
 
-    Client<AF_INET> c { argv[3] };
-    c.connect_to(std::move(server_address));
-    c.communicate();
+    uint16_t port = static_cast<uint16_t>(std::stoul(argv[2]));
+    if (std::strncmp(argv[1], "unix:", 5) == 0) {
+        Run<AF_UNIX>(argv[1] + 5, port, argv[3], backend, load_mode, load, heartbeat);
+    } else if (std::strchr(argv[1], ':') != nullptr) {
+        Run<AF_INET6>(argv[1], port, argv[3], backend, load_mode, load, heartbeat);
+    } else {
+        Run<AF_INET>(argv[1], port, argv[3], backend, load_mode, load, heartbeat);
+    }
 }
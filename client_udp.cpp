@@ -1,19 +1,48 @@
 #include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
+#include <iostream>
+#include <iterator>
+#include <random>
 #include <string>
+#include <vector>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#include "Fragment.hpp"
 #include "Logger.hpp"
 #define UDP
 #include "Global.hpp"
 
+#define _SEND_BURST_ 64UL
+
+// "K,M": every K data fragments are followed by M repair datagrams, any K of the K + M rebuild the block
+bool ParseFecSpec(char const* spec, uint8_t& block_size, uint8_t& repairs) noexcept
+{
+    unsigned long k, m;
+    char tail;
+    if (std::sscanf(spec, "%lu,%lu%c", &k, &m, &tail) != 2 || k == 0 || k + m > 256) {
+        return false;
+    }
+    block_size = static_cast<uint8_t>(m != 0 ? k : 0);
+    repairs    = static_cast<uint8_t>(m);
+    return true;
+}
+
 int32_t main(int32_t argc, char** argv)
 {
-    if (argc != 4) {
-        LogToStdErrAndTerminate(std::string("Usage: ") + argv[0] + " <IP> <PORT> <MESSAGE>");
+    bool fec = argc == 6 && std::strcmp(argv[4], "--fec") == 0;
+    if (argc != 4 && !fec) {
+        LogToStdErrAndTerminate(std::string("Usage: ") + argv[0] + " <IP> <PORT> <MESSAGE | - for stdin> [--fec K,M]");
+    }
+    uint8_t block_size {};
+    uint8_t repairs {};
+    if (fec && !ParseFecSpec(argv[5], block_size, repairs)) {
+        LogToStdErrAndTerminate("Invalid FEC spec, expected K,M with K >= 1 and K + M <= 256");
     }
 
     int32_t client_socket = socket(_SOCK_ADDR_TYPE_, _SOCK_PROTO_TYPE_, 0);
@@ -23,13 +52,76 @@ int32_t main(int32_t argc, char** argv)
     inet_pton(_SOCK_ADDR_TYPE_, argv[1], &server_address.sin_addr);   // server_address.sin_addr.s_addr = inet_addr(argv[1]);
     server_address.sin_port = htons(std::stoul(argv[2]));
 
-    size_t sizeOfMessage = std::strlen(argv[3]);
-    for (size_t toSend {}; toSend < sizeOfMessage; toSend += _BUF_SIZE_) {
-        int32_t numOfBytes = sendto(client_socket, argv[3] + toSend, std::min(_BUF_SIZE_, sizeOfMessage - toSend), 0, reinterpret_cast<sockaddr*>(&server_address), sizeof(server_address));
-        if (numOfBytes == -1) {
+    std::string message;
+    if (std::strcmp(argv[3], "-") == 0) {
+        message.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        message = argv[3];
+    }
+    size_t sizeOfMessage = message.size();
+    if (sizeOfMessage > s_MAX_FRAGMENTS * s_FRAGMENT_PAYLOAD) {
+        LogToStdErrAndTerminate("Message too large to fragment");
+    }
+
+    // Every data fragment is gathered from its own header plus a slice of the message, so the payload is never
+    // copied. Each block's repairs follow its data, so the server can rebuild it before the next block arrives.
+    uint32_t message_id = std::random_device {}();
+    uint16_t count      = FragmentCount(sizeOfMessage);
+    size_t span         = block_size != 0 ? block_size : count;
+    size_t blocks       = (count + span - 1) / span;
+    size_t total        = count + blocks * repairs;
+    std::vector<std::array<char, s_FRAGMENT_HEADER_SIZE>> headers(total);
+    std::vector<std::array<iovec, 2>> iovecs(total);
+    std::vector<mmsghdr> fragments(total);
+    std::vector<char> parity(blocks * repairs * s_FRAGMENT_PAYLOAD);
+    std::vector<char const*> block_data(span);
+    std::vector<size_t> block_lens(span);
+    size_t datagrams {};
+    auto gather = [&](char const* payload, size_t len) {
+        iovecs[datagrams][0]                     = { headers[datagrams].data(), s_FRAGMENT_HEADER_SIZE };
+        iovecs[datagrams][1]                     = { const_cast<char*>(payload), len };
+        fragments[datagrams].msg_hdr             = {};
+        fragments[datagrams].msg_hdr.msg_name    = &server_address;
+        fragments[datagrams].msg_hdr.msg_namelen = sizeof(server_address);
+        fragments[datagrams].msg_hdr.msg_iov     = iovecs[datagrams].data();
+        fragments[datagrams].msg_hdr.msg_iovlen  = iovecs[datagrams].size();
+        ++datagrams;
+    };
+    for (size_t first {}; first < count; first += span) {
+        size_t k = std::min<size_t>(span, count - first);
+        for (size_t column {}; column < k; ++column) {
+            size_t index       = first + column;
+            block_data[column] = message.data() + index * s_FRAGMENT_PAYLOAD;
+            block_lens[column] = FragmentLength(sizeOfMessage, index);
+            EncodeFragmentHeader(headers[datagrams].data(), message_id, index, count, sizeOfMessage, block_size);
+            gather(block_data[column], block_lens[column]);
+        }
+        for (uint8_t row {}; row < repairs; ++row) {
+            char* repair = parity.data() + (first / span * repairs + row) * s_FRAGMENT_PAYLOAD;
+            EncodeRepair(repair, block_lens[0], block_size, row, block_data.data(), block_lens.data(), k);
+            EncodeRepairHeader(headers[datagrams].data(), message_id, first, count, sizeOfMessage, block_size, row);
+            gather(repair, block_lens[0]);
+        }
+    }
+
+    size_t bursts {};
+    for (size_t sent {}; sent < datagrams;) {
+        int32_t numOfFragments = sendmmsg(client_socket, fragments.data() + sent, std::min(_SEND_BURST_, datagrams - sent), 0);
+        if (numOfFragments == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             LogToStdErrAndTerminate("Could not send message");
         }
-        LogToStdOut("Sent " + std::to_string(numOfBytes) + " bytes of data to server");
+        sent += numOfFragments;
+        ++bursts;
+    }
+    std::string protection;
+    if (repairs != 0) {
+        protection = " and " + std::to_string(datagrams - count) + " repairs (FEC " + std::to_string(block_size) + "+" + std::to_string(repairs)
+                   + ", " + GfKernelName() + " kernel)";
     }
+    LogToStdOut("Sent " + std::to_string(sizeOfMessage) + " bytes of data to server in " + std::to_string(count) + " fragments"
+                + protection + " over " + std::to_string(bursts) + " sendmmsg calls");
     close(client_socket);
-}
\ No newline at end of file
+}
@@ -0,0 +1,913 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Fragment.hpp"
+#include "Histogram.hpp"
+#include "Protocol.hpp"
+
+// Loopback benchmark for every server/client pair in the tree. Servers and peers run as child processes from
+// the build directory; where the pair's own client cannot report timing, cn_bench drives the server itself.
+//
+//   tcp_chat  in-process protocol clients against server_tcp, latency is send to fan-out delivery
+//   udp       in-process fragmenting senders against server_udp --echo, latency is send to echoed line
+//   dll       sender_dll/receiver_dll, throughput only: the sender never blocks, so its lines and the
+//             receiver's reach the pipes in bursts that say nothing about when a frame crossed the link
+//   dll_file  sender_dll/receiver_dll --file, throughput only
+//   snw       stop_n_wait_send/recv per window size, latency is frame to ACK
+//
+// Latencies derived from child output include pipe delivery to cn_bench. Results go to JSON (stdout by
+// default) and a one-line summary per case goes to stderr.
+
+using Clock = std::chrono::steady_clock;
+
+constexpr char const* s_LOOPBACK { "127.0.0.1" };
+constexpr std::chrono::seconds s_CASE_TIMEOUT { 60 };
+
+struct Options {
+    std::string bin_dir;
+    std::string json_path { "-" };
+    bool quick {};
+    bool tcp { true };
+    bool udp { true };
+    bool dll { true };
+    bool snw { true };
+};
+
+struct Result {
+    std::string pair;
+    size_t message_size {};
+    int clients {};
+    int window {};
+    uint64_t messages {};
+    uint64_t bytes {};
+    uint64_t lost {};
+    double seconds {};
+    Histogram latency;   // nanoseconds; empty when the pair exposes no per-message timing
+    std::string error;
+};
+
+struct Child {
+    pid_t pid;
+    int in;    // write end of the child's stdin, or -1
+    int out;   // read end of the child's stdout, or -1
+};
+
+uint64_t NowNs() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Children keep stderr quiet and stdin/stdout on /dev/null unless piped
+Child Spawn(std::vector<std::string> const& args, bool pipe_in, bool pipe_out) noexcept
+{
+    int in_pipe[2] { -1, -1 };
+    int out_pipe[2] { -1, -1 };
+    if ((pipe_in && pipe2(in_pipe, O_CLOEXEC) != 0) || (pipe_out && pipe2(out_pipe, O_CLOEXEC) != 0)) {
+        return { -1, -1, -1 };
+    }
+    std::vector<char*> argv;
+    for (std::string const& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(pipe_in ? in_pipe[0] : null, STDIN_FILENO);
+        dup2(pipe_out ? out_pipe[1] : null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    if (pipe_in) {
+        close(in_pipe[0]);
+    }
+    if (pipe_out) {
+        close(out_pipe[1]);
+    }
+    return { pid, pipe_in ? in_pipe[1] : -1, pipe_out ? out_pipe[0] : -1 };
+}
+
+// Returns the exit status, killing the child if it outlives the timeout
+int WaitExit(Child& child, std::chrono::milliseconds timeout) noexcept
+{
+    int status    = -1;
+    auto deadline = Clock::now() + timeout;
+    while (child.pid > 0 && waitpid(child.pid, &status, WNOHANG) == 0) {
+        if (Clock::now() > deadline) {
+            kill(child.pid, SIGKILL);
+            waitpid(child.pid, &status, 0);
+            status = -1;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    for (int* fd : { &child.in, &child.out }) {
+        if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    child.pid = -1;
+    return status;
+}
+
+// Watches /proc/net/{tcp,udp} rather than probing, so the server sees no stray connection or datagram
+bool WaitListening(char const* proto, uint16_t port, Child const& child) noexcept
+{
+    std::string table = std::string("/proc/net/") + proto;
+    unsigned state    = std::strcmp(proto, "tcp") == 0 ? 0x0A : 0x07;   // LISTEN / unconnected datagram socket
+    auto deadline     = Clock::now() + std::chrono::seconds(5);
+    while (Clock::now() < deadline) {
+        if (waitpid(child.pid, nullptr, WNOHANG) != 0) {
+            return false;
+        }
+        FILE* file = std::fopen(table.c_str(), "r");
+        char line[256];
+        while (file != nullptr && std::fgets(line, sizeof(line), file) != nullptr) {
+            unsigned local_port, st;
+            if (std::sscanf(line, " %*d: %*[0-9A-Fa-f]:%x %*[0-9A-Fa-f]:%*x %x", &local_port, &st) == 2 && local_port == port && st == state) {
+                std::fclose(file);
+                return true;
+            }
+        }
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+uint16_t FreePort() noexcept
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, s_LOOPBACK, &address.sin_addr);
+    socklen_t len = sizeof(address);
+    bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &len);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+sockaddr_in LoopbackAddress(uint16_t port) noexcept
+{
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port   = htons(port);
+    inet_pton(AF_INET, s_LOOPBACK, &address.sin_addr);
+    return address;
+}
+
+bool SendAll(int fd, char const* data, size_t len) noexcept
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Splits the stdout of several children into lines, stamping each with the time it was read
+class LineReader {
+public:
+    void add(int fd) { m_streams.push_back({ fd, {}, false }); }
+
+    // Calls on_line(stream, line, now_ns) for every complete line. Returns false once every stream is at EOF.
+    template <typename OnLine>
+    bool poll(int timeout_ms, OnLine&& on_line)
+    {
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        for (size_t index {}; index < m_streams.size(); ++index) {
+            if (!m_streams[index].closed) {
+                fds.push_back({ m_streams[index].fd, POLLIN, 0 });
+                owners.push_back(index);
+            }
+        }
+        if (fds.empty()) {
+            return false;
+        }
+        if (::poll(fds.data(), fds.size(), timeout_ms) <= 0) {
+            return true;
+        }
+        char buffer[64 * 1024];
+        for (size_t index {}; index < fds.size(); ++index) {
+            if (!(fds[index].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            Stream& stream = m_streams[owners[index]];
+            ssize_t n      = read(stream.fd, buffer, sizeof(buffer));
+            uint64_t now   = NowNs();
+            if (n <= 0) {
+                stream.closed = true;
+                n             = 0;
+            }
+            stream.pending.append(buffer, n);
+            size_t start = 0;
+            for (size_t end; (end = stream.pending.find('\n', start)) != std::string::npos; start = end + 1) {
+                on_line(owners[index], stream.pending.data() + start, end - start, now);
+            }
+            stream.pending.erase(0, start);
+        }
+        return true;
+    }
+
+private:
+    struct Stream {
+        int fd;
+        std::string pending;
+        bool closed;
+    };
+
+    std::vector<Stream> m_streams;
+};
+
+bool StartsWith(char const* line, size_t len, char const* prefix) noexcept
+{
+    size_t prefix_len = std::strlen(prefix);
+    return len >= prefix_len && std::memcmp(line, prefix, prefix_len) == 0;
+}
+
+// Fan-out state shared by the chat clients of one case
+struct ChatShared {
+    explicit ChatShared(int clients)
+        : delivered(clients)
+        , waiting(clients)
+    {
+        for (int index {}; index < clients; ++index) {
+            wakeups.push_back(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        }
+    }
+
+    ~ChatShared()
+    {
+        for (int wakeup : wakeups) {
+            close(wakeup);
+        }
+    }
+
+    std::vector<std::atomic<uint64_t>> delivered;   // copies of each client's messages received by the others
+    std::vector<std::atomic<bool>> waiting;         // client is parked on its wakeup with a full window
+    std::vector<int> wakeups;
+    std::atomic<int> notices {};
+    std::atomic<bool> go {};
+    std::atomic<bool> failed {};
+};
+
+// One chat client. A message is "<index> <send ns>" padded to `size`; the server prefixes it with the sender's
+// name and delivers it to every other client. Each client keeps at most `window` messages per peer in flight,
+// so the measurement is closed loop and the server's slow-consumer limits are never reached.
+void ChatClient(int fd, int index, int clients, size_t size, uint64_t messages, int window, ChatShared& shared, Histogram& latency) noexcept
+{
+    FrameParser parser { 1 << 16 };
+    std::vector<char> frame(s_FRAME_HEADER_SIZE + std::max<size_t>(size, 32));
+    std::string name = "b" + std::to_string(index);
+    EncodeHeader(frame.data(), FrameType::HELLO, 0, name.size());
+    std::memcpy(frame.data() + s_FRAME_HEADER_SIZE, name.data(), name.size());
+    if (!SendAll(fd, frame.data(), s_FRAME_HEADER_SIZE + name.size())) {
+        shared.failed = true;
+        return;
+    }
+
+    uint64_t peers    = clients - 1;
+    uint64_t expected = messages * peers;
+    uint64_t sent     = 0;
+    uint64_t received = 0;
+    auto deadline     = Clock::now() + s_CASE_TIMEOUT;
+    while (!shared.failed.load(std::memory_order_relaxed)) {
+        bool go = shared.go.load(std::memory_order_acquire);
+        if (go && sent == messages && received == expected) {
+            return;
+        }
+        auto window_open = [&] { return sent * peers - shared.delivered[index].load() < window * peers; };
+        bool sending     = go && sent < messages;
+        bool can_send    = sending && window_open();
+        if (can_send) {
+            char* payload = frame.data() + s_FRAME_HEADER_SIZE;
+            int len       = std::snprintf(payload, size + 1, "%d %llu ", index, static_cast<unsigned long long>(NowNs()));
+            std::memset(payload + len, 'x', size > static_cast<size_t>(len) ? size - len : 0);
+            EncodeHeader(frame.data(), FrameType::CHAT, 0, std::max<size_t>(size, len));
+            if (!SendAll(fd, frame.data(), s_FRAME_HEADER_SIZE + std::max<size_t>(size, len))) {
+                break;
+            }
+            ++sent;
+        }
+
+        // A full window reopens on other clients' threads, which signal the wakeup while this one is parked.
+        // Parking is published before the window is checked again, so a delivery in between is not missed.
+        bool parked = sending && !can_send;
+        if (parked) {
+            shared.waiting[index].store(true);
+            parked = !window_open();
+        }
+        pollfd pfds[2] {
+            { fd, POLLIN, 0 },
+            { shared.wakeups[index], POLLIN, 0 }
+        };
+        int ready = ::poll(pfds, 2, parked || !sending ? 5 : 0);
+        shared.waiting[index].store(false, std::memory_order_relaxed);
+        if (ready > 0 && (pfds[1].revents & POLLIN)) {
+            uint64_t count;
+            (void)!read(shared.wakeups[index], &count, sizeof(count));
+        }
+        if (ready > 0 && (pfds[0].revents & POLLIN)) {
+            if (parser.fill(fd) <= 0) {
+                break;
+            }
+            FrameHeader header;
+            char const* payload;
+            while (parser.next(header, payload)) {
+                if (header.type == FrameType::NOTICE && !go) {
+                    shared.notices.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                char const* body = static_cast<char const*>(memmem(payload, header.length, "]: ", 3));
+                if (header.type != FrameType::CHAT || body == nullptr) {
+                    continue;
+                }
+                char text[48] {};
+                std::memcpy(text, body + 3, std::min<size_t>(sizeof(text) - 1, payload + header.length - body - 3));
+                int sender;
+                unsigned long long sent_at;
+                if (std::sscanf(text, "%d %llu", &sender, &sent_at) != 2 || sender < 0 || sender >= clients) {
+                    continue;
+                }
+                latency.record(NowNs() - sent_at);
+                shared.delivered[sender].fetch_add(1);
+                if (shared.waiting[sender].load() && shared.waiting[sender].exchange(false)) {
+                    uint64_t one = 1;
+                    (void)!write(shared.wakeups[sender], &one, sizeof(one));
+                }
+                ++received;
+            }
+            if (parser.error()) {
+                break;
+            }
+        }
+        if (Clock::now() > deadline) {
+            break;
+        }
+    }
+    shared.failed = true;
+}
+
+Result BenchTcpChat(Options const& options, size_t size, int clients)
+{
+    Result result;
+    result.pair         = "tcp_chat";
+    result.message_size = size;
+    result.clients      = clients;
+    result.window       = 4;
+
+    uint64_t budget   = options.quick ? 20000 : 200000;
+    uint64_t messages = std::clamp<uint64_t>(budget / (clients * (clients - 1)), 20, 20000);
+    uint16_t port     = FreePort();
+    Child server      = Spawn({ options.bin_dir + "/server_tcp", s_LOOPBACK, std::to_string(port), "128" }, true, false);
+    if (server.pid < 0 || !WaitListening("tcp", port, server)) {
+        result.error = "server_tcp did not start";
+        WaitExit(server, std::chrono::milliseconds(0));
+        return result;
+    }
+
+    std::vector<int> fds;
+    for (int index {}; index < clients; ++index) {
+        sockaddr_in address = LoopbackAddress(port);
+        int fd              = socket(AF_INET, SOCK_STREAM, 0);
+        int on              = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            result.error = "connect failed";
+            close(fd);
+            break;
+        }
+        fds.push_back(fd);
+    }
+
+    ChatShared shared { clients };
+    std::vector<Histogram> latencies(fds.size());
+    std::vector<std::thread> threads;
+    for (size_t index {}; index < fds.size() && result.error.empty(); ++index) {
+        threads.emplace_back(ChatClient, fds[index], static_cast<int>(index), clients, size, messages, result.window, std::ref(shared), std::ref(latencies[index]));
+    }
+
+    // Every pair of clients produces exactly one "connected" notice, to whichever registered first, so all
+    // of them being in means every client is registered and will see every message
+    int pairs     = clients * (clients - 1) / 2;
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (result.error.empty() && shared.notices.load() < pairs && !shared.failed && Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto start = Clock::now();
+    shared.go.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (Histogram const& latency : latencies) {
+        result.latency.merge(latency);
+    }
+    result.messages = result.latency.count();
+    result.bytes    = result.messages * size;
+    if (result.error.empty() && shared.failed) {
+        result.error = "client failed or timed out";
+    }
+    if (server.in != -1) {
+        (void)!write(server.in, "0\n", 2);
+    }
+    WaitExit(server, std::chrono::seconds(5));
+    for (int fd : fds) {
+        close(fd);
+    }
+    return result;
+}
+
+// One fragmenting UDP sender. server_udp --echo prints every reassembled message, so a message counts as
+// delivered once its line appears on the server's stdout. A window that stops moving for s_UDP_STALL is
+// written off as lost.
+constexpr std::chrono::milliseconds s_UDP_STALL { 500 };
+
+struct UdpShared {
+    explicit UdpShared(int clients)
+        : echoed(clients)
+        , written_off(clients)
+    {
+    }
+
+    std::vector<std::atomic<uint64_t>> echoed;
+    std::vector<std::atomic<uint64_t>> written_off;
+    std::atomic<int> finished {};
+};
+
+void UdpClient(uint16_t port, int index, size_t size, uint64_t messages, int window, UdpShared& shared) noexcept
+{
+    int fd              = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = LoopbackAddress(port);
+    std::vector<char> message(std::max<size_t>(size, 48));
+    char datagram[s_MAX_DATAGRAM];
+    uint32_t message_id = std::random_device {}();
+
+    // Signed because a message written off as lost may still be echoed later
+    auto in_flight = [&](uint64_t sent) {
+        return static_cast<int64_t>(sent - shared.echoed[index].load(std::memory_order_relaxed) - shared.written_off[index].load(std::memory_order_relaxed));
+    };
+    auto settle = [&](uint64_t sent, int64_t limit) {
+        auto progress_at = Clock::now();
+        int64_t last     = in_flight(sent);
+        while (in_flight(sent) > limit) {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+            if (in_flight(sent) != last) {
+                last        = in_flight(sent);
+                progress_at = Clock::now();
+            } else if (Clock::now() - progress_at > s_UDP_STALL) {
+                shared.written_off[index].fetch_add(last, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    for (uint64_t sent {}; sent < messages;) {
+        settle(sent, window - 1);
+        int len = std::snprintf(message.data(), message.size(), "CNB %d %llu ", index, static_cast<unsigned long long>(NowNs()));
+        std::memset(message.data() + len, 'x', message.size() - len);
+        size_t total   = std::max<size_t>(size, len);
+        uint16_t count = FragmentCount(total);
+        ++message_id;
+        for (uint16_t fragment {}; fragment < count; ++fragment) {
+            size_t offset = static_cast<size_t>(fragment) * s_FRAGMENT_PAYLOAD;
+            size_t part   = std::min(s_FRAGMENT_PAYLOAD, total - offset);
+            EncodeFragmentHeader(datagram, message_id, fragment, count, total);
+            std::memcpy(datagram + s_FRAGMENT_HEADER_SIZE, message.data() + offset, part);
+            sendto(fd, datagram, s_FRAGMENT_HEADER_SIZE + part, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        }
+        ++sent;
+        if (sent == messages) {
+            settle(sent, 0);
+        }
+    }
+    close(fd);
+    shared.finished.fetch_add(1, std::memory_order_release);
+}
+
+Result BenchUdp(Options const& options, size_t size, int clients)
+{
+    Result result;
+    result.pair         = "udp";
+    result.message_size = size;
+    result.clients      = clients;
+    result.window       = 32;
+
+    uint64_t messages = (options.quick ? 5000 : 50000) / clients;
+    uint16_t port     = FreePort();
+    Child server      = Spawn({ options.bin_dir + "/server_udp", s_LOOPBACK, std::to_string(port), "--batch", "32", "--echo" }, false, true);
+    if (server.pid < 0 || !WaitListening("udp", port, server)) {
+        result.error = "server_udp did not start";
+        WaitExit(server, std::chrono::milliseconds(0));
+        return result;
+    }
+
+    UdpShared shared { clients };
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (int index {}; index < clients; ++index) {
+        threads.emplace_back(UdpClient, port, index, size, messages, result.window, std::ref(shared));
+    }
+    LineReader reader;
+    reader.add(server.out);
+    auto on_line = [&](size_t, char const* line, size_t len, uint64_t now) {
+        int client;
+        unsigned long long sent_at;
+        if (!StartsWith(line, len, "CNB ") || std::sscanf(line, "CNB %d %llu", &client, &sent_at) != 2 || client < 0 || client >= clients) {
+            return;
+        }
+        result.latency.record(now - sent_at);
+        shared.echoed[client].fetch_add(1, std::memory_order_relaxed);
+    };
+    while (shared.finished.load(std::memory_order_acquire) < clients && reader.poll(10, on_line)) {
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // A zero-length datagram ends server_udp's receive loop
+    int fd              = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = LoopbackAddress(port);
+    sendto(fd, "", 0, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    close(fd);
+    while (reader.poll(100, [](size_t, char const*, size_t, uint64_t) {})) {
+    }
+    WaitExit(server, std::chrono::seconds(5));
+
+    result.messages = result.latency.count();
+    result.bytes    = result.messages * size;
+    result.lost     = messages * clients - std::min<uint64_t>(result.messages, messages * clients);
+    return result;
+}
+
+// Pairs a sender's lines: the line for sending frame N starts its clock and the line for its ACK stops it.
+// Frames sent more than once keep their first time.
+struct FrameTimes {
+    explicit FrameTimes(size_t frames)
+        : sent(frames)
+        , done(frames)
+    {
+    }
+
+    void record(Histogram& latency, uint64_t& first, uint64_t& last) const noexcept
+    {
+        for (size_t frame {}; frame < sent.size(); ++frame) {
+            if (sent[frame] != 0 && done[frame] != 0) {
+                latency.record(done[frame] > sent[frame] ? done[frame] - sent[frame] : 0);
+                first = std::min(first, sent[frame]);
+                last  = std::max(last, done[frame]);
+            }
+        }
+    }
+
+    std::vector<uint64_t> sent;
+    std::vector<uint64_t> done;
+};
+
+Result BenchDll(Options const& options)
+{
+    Result result;
+    result.pair    = "dll";
+    result.clients = 1;
+    result.window  = 1;
+
+    int frames        = options.quick ? 2000 : 20000;
+    uint16_t port     = FreePort();
+    std::string ports = std::to_string(port);
+    Child receiver    = Spawn({ options.bin_dir + "/receiver_dll", s_LOOPBACK, ports }, false, true);
+    if (receiver.pid < 0 || !WaitListening("tcp", port, receiver)) {
+        result.error = "receiver_dll did not start";
+        WaitExit(receiver, std::chrono::milliseconds(0));
+        return result;
+    }
+    auto start   = Clock::now();
+    Child sender = Spawn({ options.bin_dir + "/sender_dll", s_LOOPBACK, ports, std::to_string(frames) }, false, true);
+
+    std::vector<bool> received(frames);
+    uint64_t unique = 0;
+    LineReader reader;
+    reader.add(sender.out);
+    reader.add(receiver.out);
+    size_t payload = 0;
+    auto deadline  = Clock::now() + s_CASE_TIMEOUT;
+    while (Clock::now() < deadline && reader.poll(100, [&](size_t stream, char const* line, size_t len, uint64_t) {
+        std::string text(line, len);
+        int frame;
+        if (stream == 0 && std::sscanf(text.c_str(), "Sending frame: Frame %d", &frame) == 1 && frame >= 0 && frame < frames) {
+            payload += text.size() - std::strlen("Sending frame: ");
+        } else if (stream == 1 && std::sscanf(text.c_str(), "Received frame %*d: Frame %d", &frame) == 1 && frame >= 0 && frame < frames
+                   && !received[frame]) {
+            received[frame] = true;
+            ++unique;
+        }
+    })) {
+    }
+    int sender_status   = WaitExit(sender, std::chrono::seconds(5));
+    auto stop           = Clock::now();
+    int receiver_status = WaitExit(receiver, std::chrono::seconds(5));
+
+    result.messages     = unique;
+    result.message_size = frames ? payload / frames : 0;
+    result.bytes        = result.messages * result.message_size;
+    result.lost         = frames - result.messages;
+    result.seconds      = std::chrono::duration<double>(stop - start).count();
+    if (sender_status != 0 || receiver_status != 0) {
+        result.error = "sender_dll or receiver_dll failed";
+    }
+    return result;
+}
+
+Result BenchDllFile(Options const& options, size_t size)
+{
+    Result result;
+    result.pair         = "dll_file";
+    result.message_size = size;
+    result.clients      = 1;
+    result.window       = 1;
+
+    char input[] { "/tmp/cn_bench_inXXXXXX" };
+    char output[] { "/tmp/cn_bench_outXXXXXX" };
+    int input_fd  = mkstemp(input);
+    int output_fd = mkstemp(output);
+    if (input_fd == -1 || output_fd == -1) {
+        result.error = std::string { "mkstemp failed: " } + std::strerror(errno);
+        if (input_fd != -1) {
+            close(input_fd);
+            unlink(input);
+        }
+        if (output_fd != -1) {
+            close(output_fd);
+            unlink(output);
+        }
+        return result;
+    }
+    std::mt19937_64 rng { size };
+    std::vector<uint64_t> block(8192);
+    for (size_t written {}; written < size; written += block.size() * sizeof(uint64_t)) {
+        std::generate(block.begin(), block.end(), rng);
+        (void)!write(input_fd, block.data(), std::min(block.size() * sizeof(uint64_t), size - written));
+    }
+    close(input_fd);
+    close(output_fd);
+
+    uint16_t port     = FreePort();
+    std::string ports = std::to_string(port);
+    Child receiver    = Spawn({ options.bin_dir + "/receiver_dll", s_LOOPBACK, ports, "--file", output }, false, true);
+    if (receiver.pid >= 0 && WaitListening("tcp", port, receiver)) {
+        auto start   = Clock::now();
+        Child sender = Spawn({ options.bin_dir + "/sender_dll", s_LOOPBACK, ports, "--file", input }, false, false);
+        LineReader reader;
+        reader.add(receiver.out);
+        unsigned long long frames = 0;
+        unsigned long long total  = 0;
+        auto deadline = Clock::now() + s_CASE_TIMEOUT;
+        while (Clock::now() < deadline && reader.poll(100, [&](size_t, char const* line, size_t len, uint64_t) {
+            char const* counts = static_cast<char const*>(memmem(line, len, ": ", 2));
+            if (StartsWith(line, len, "Received ") && counts != nullptr) {
+                std::sscanf(std::string(counts, line + len - counts).c_str(), ": %llu of %llu frames", &frames, &total);
+            }
+        })) {
+        }
+        int sender_status   = WaitExit(sender, std::chrono::seconds(5));
+        int receiver_status = WaitExit(receiver, std::chrono::seconds(5));
+        result.seconds      = std::chrono::duration<double>(Clock::now() - start).count();
+        result.messages     = frames;
+        result.lost         = total - frames;
+        result.bytes        = frames == total ? size : 0;
+        if (sender_status != 0 || receiver_status != 0 || total == 0) {
+            result.error = "sender_dll or receiver_dll failed";
+        }
+    } else {
+        result.error = "receiver_dll did not start";
+        WaitExit(receiver, std::chrono::milliseconds(0));
+    }
+    unlink(input);
+    unlink(output);
+    return result;
+}
+
+Result BenchStopAndWait(Options const& options, int window)
+{
+    Result result;
+    result.pair         = "snw";
+    result.message_size = 1024;   // fixed frame size of stop_n_wait_send
+    result.clients      = 1;
+    result.window       = window;
+
+    int frames        = options.quick ? 500 : 5000;
+    uint16_t port     = FreePort();
+    std::string ports = std::to_string(port);
+    Child receiver    = Spawn({ options.bin_dir + "/stop_n_wait_recv", s_LOOPBACK, ports, "1", std::to_string(window) }, false, false);
+    if (receiver.pid < 0 || !WaitListening("tcp", port, receiver)) {
+        result.error = "stop_n_wait_recv did not start";
+        WaitExit(receiver, std::chrono::milliseconds(0));
+        return result;
+    }
+    Child sender = Spawn({ options.bin_dir + "/stop_n_wait_send", s_LOOPBACK, ports, std::to_string(window), std::to_string(frames) }, false, true);
+
+    FrameTimes times(frames);
+    LineReader reader;
+    reader.add(sender.out);
+    auto deadline = Clock::now() + s_CASE_TIMEOUT;
+    while (Clock::now() < deadline && reader.poll(100, [&](size_t, char const* line, size_t len, uint64_t now) {
+        std::string text(line, len);
+        int frame;
+        if (std::sscanf(text.c_str(), "Sending frame %d", &frame) == 1 && frame >= 0 && frame < frames) {
+            times.sent[frame] = times.sent[frame] ? times.sent[frame] : now;
+        } else if (std::sscanf(text.c_str(), "Received ACK %d", &frame) == 1 && frame >= 0 && frame < frames) {
+            times.done[frame] = times.done[frame] ? times.done[frame] : now;
+        }
+    })) {
+    }
+    int sender_status   = WaitExit(sender, std::chrono::seconds(5));
+    int receiver_status = WaitExit(receiver, std::chrono::seconds(5));
+
+    uint64_t first = UINT64_MAX;
+    uint64_t last  = 0;
+    times.record(result.latency, first, last);
+    result.messages = result.latency.count();
+    result.bytes    = result.messages * result.message_size;
+    result.lost     = frames - result.messages;
+    result.seconds  = last > first ? (last - first) / 1e9 : 0;
+    if (sender_status != 0 || receiver_status != 0) {
+        result.error = "stop_n_wait_send or stop_n_wait_recv failed";
+    }
+    return result;
+}
+
+void Summarise(Result const& result) noexcept
+{
+    if (!result.error.empty()) {
+        std::fprintf(stderr, "%-8s size %-8zu clients %-3d window %-3d ERROR %s\n", result.pair.c_str(), result.message_size, result.clients, result.window, result.error.c_str());
+    } else if (result.latency.count() == 0) {
+        std::fprintf(stderr,
+                     "%-8s size %-8zu clients %-3d window %-3d %10.0f msg/s %9.2f MB/s  latency -  lost %llu\n",
+                     result.pair.c_str(),
+                     result.message_size,
+                     result.clients,
+                     result.window,
+                     result.seconds > 0 ? result.messages / result.seconds : 0,
+                     result.seconds > 0 ? result.bytes / result.seconds / 1e6 : 0,
+                     static_cast<unsigned long long>(result.lost));
+    } else {
+        std::fprintf(stderr,
+                     "%-8s size %-8zu clients %-3d window %-3d %10.0f msg/s %9.2f MB/s  p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  lost %llu\n",
+                     result.pair.c_str(),
+                     result.message_size,
+                     result.clients,
+                     result.window,
+                     result.seconds > 0 ? result.messages / result.seconds : 0,
+                     result.seconds > 0 ? result.bytes / result.seconds / 1e6 : 0,
+                     result.latency.percentile(0.50) / 1e3,
+                     result.latency.percentile(0.99) / 1e3,
+                     result.latency.percentile(0.999) / 1e3,
+                     static_cast<unsigned long long>(result.lost));
+    }
+    std::fflush(stderr);
+}
+
+void WriteJson(FILE* out, Options const& options, std::vector<Result> const& results) noexcept
+{
+    std::fprintf(out, "{\n  \"benchmark\": \"cn_bench\",\n  \"quick\": %s,\n  \"results\": [", options.quick ? "true" : "false");
+    for (size_t index {}; index < results.size(); ++index) {
+        Result const& result = results[index];
+        std::fprintf(out,
+                     "%s\n    {\"pair\": \"%s\", \"message_size\": %zu, \"clients\": %d, \"window\": %d, \"messages\": %llu, "
+                     "\"bytes\": %llu, \"lost\": %llu, \"seconds\": %.6f, \"messages_per_sec\": %.1f, \"throughput_mbps\": %.3f, ",
+                     index ? "," : "",
+                     result.pair.c_str(),
+                     result.message_size,
+                     result.clients,
+                     result.window,
+                     static_cast<unsigned long long>(result.messages),
+                     static_cast<unsigned long long>(result.bytes),
+                     static_cast<unsigned long long>(result.lost),
+                     result.seconds,
+                     result.seconds > 0 ? result.messages / result.seconds : 0,
+                     result.seconds > 0 ? result.bytes * 8 / result.seconds / 1e6 : 0);
+        if (result.latency.count() == 0) {
+            std::fprintf(out, "\"latency_us\": null");
+        } else {
+            std::fprintf(out,
+                         "\"latency_us\": {\"count\": %llu, \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+                         static_cast<unsigned long long>(result.latency.count()),
+                         result.latency.min() / 1e3,
+                         result.latency.mean() / 1e3,
+                         result.latency.percentile(0.50) / 1e3,
+                         result.latency.percentile(0.99) / 1e3,
+                         result.latency.percentile(0.999) / 1e3,
+                         result.latency.max() / 1e3);
+        }
+        if (!result.error.empty()) {
+            std::fprintf(out, ", \"error\": \"%s\"", result.error.c_str());
+        }
+        std::fprintf(out, "}");
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+}
+
+auto main(int32_t argc, char** argv) -> int32_t
+{
+    Options options;
+    char self[4096];
+    ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    options.bin_dir  = self_len > 0 ? std::string(self, self_len) : std::string(argv[0]);
+    options.bin_dir  = options.bin_dir.substr(0, options.bin_dir.find_last_of('/') == std::string::npos ? 1 : options.bin_dir.find_last_of('/'));
+
+    for (int32_t arg = 1; arg < argc; ++arg) {
+        if (std::strcmp(argv[arg], "--quick") == 0) {
+            options.quick = true;
+        } else if (std::strcmp(argv[arg], "--json") == 0 && arg + 1 < argc) {
+            options.json_path = argv[++arg];
+        } else if (std::strcmp(argv[arg], "--bin") == 0 && arg + 1 < argc) {
+            options.bin_dir = argv[++arg];
+        } else if (std::strcmp(argv[arg], "--only") == 0 && arg + 1 < argc) {
+            std::string only = std::string(",") + argv[++arg] + ",";
+            options.tcp      = only.find(",tcp,") != std::string::npos;
+            options.udp      = only.find(",udp,") != std::string::npos;
+            options.dll      = only.find(",dll,") != std::string::npos;
+            options.snw      = only.find(",snw,") != std::string::npos;
+        } else {
+            std::fprintf(stderr, "Usage: %s [--quick] [--only tcp,udp,dll,snw] [--json PATH | -] [--bin DIR]\n", argv[0]);
+            std::fflush(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Result> results;
+    auto run = [&](Result result) {
+        Summarise(result);
+        results.push_back(std::move(result));
+    };
+    if (options.tcp) {
+        for (size_t size : { 32, 512, 2048 }) {
+            for (int clients : options.quick ? std::vector<int> { 2, 8 } : std::vector<int> { 2, 8, 32 }) {
+                run(BenchTcpChat(options, size, clients));
+            }
+        }
+    }
+    if (options.udp) {
+        for (size_t size : { 64, 1400, 8192 }) {
+            for (int clients : { 1, 4 }) {
+                run(BenchUdp(options, size, clients));
+            }
+        }
+    }
+    if (options.dll) {
+        run(BenchDll(options));
+        for (size_t size : options.quick ? std::vector<size_t> { 1 << 20 } : std::vector<size_t> { 1 << 20, 32 << 20 }) {
+            run(BenchDllFile(options, size));
+        }
+    }
+    if (options.snw) {
+        for (int window : { 1, 16, 64 }) {
+            run(BenchStopAndWait(options, window));
+        }
+    }
+
+    FILE* out = options.json_path == "-" ? stdout : std::fopen(options.json_path.c_str(), "w");
+    if (out == nullptr) {
+        std::fprintf(stderr, "Could not open %s\n", options.json_path.c_str());
+        std::fflush(stderr);
+        return EXIT_FAILURE;
+    }
+    WriteJson(out, options, results);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    bool failed = std::any_of(results.begin(), results.end(), [](Result const& result) { return !result.error.empty(); });
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,49 +1,162 @@
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <string>
 #include <array>
-#include <map>
+#include <deque>
+#include <thread>
+#include <vector>
 
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
-#include <poll.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <unistd.h>
 
-template <int32_t Domain, int32_t Protocol = 0>
-class TCPServer {
+#include "LockFreeQueue.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+#include "Reactor.hpp"
+#include "SharedBuffer.hpp"
+#include "SocketAddress.hpp"
+#include "TimingWheel.hpp"
+
+enum class SlowConsumer : uint8_t {
+    DISCONNECT,
+    DROP
+};
+
+// How client sockets turn queued bytes into TCP segments. NODELAY sends each end-of-iteration flush at once;
+// NAGLE leaves the kernel default, which holds small writes while data is unacknowledged; CORK only emits
+// full segments while a client has a backlog and pushes the tail when its queue drains. UNIX sockets ignore it.
+enum class SegmentPolicy : uint8_t {
+    NODELAY,
+    NAGLE,
+    CORK
+};
+
+// Per-client outbound queue limits. Above high_water a client is either disconnected or skipped
+// for new broadcasts; a skipped client resumes once its backlog drains below low_water.
+// New clients are first sent the last history_messages chat messages, at most history_bytes of them.
+// A connection that has not said HELLO within handshake_timeout is closed. Once greeted, a client silent
+// for heartbeat is sent a PING and one silent for idle_timeout is disconnected; zero turns either off.
+struct FanOutPolicy {
+    size_t high_water { 256 * 1024 };
+    size_t low_water { 64 * 1024 };
+    SlowConsumer on_slow { SlowConsumer::DISCONNECT };
+    SegmentPolicy segments { SegmentPolicy::NODELAY };
+    size_t history_messages { 64 };
+    size_t history_bytes { 64 * 1024 };
+    std::chrono::milliseconds handshake_timeout { 5000 };
+    std::chrono::milliseconds heartbeat {};
+    std::chrono::milliseconds idle_timeout {};
+};
+
+// One formatted broadcast. A chat message keeps its sender's "Message from [name]: " prefix in a buffer
+// made once per connection, and goes out as header, prefix and body slices; notices have no prefix.
+struct Broadcast {
+    SharedBuffer frame;    // frame header followed by the body
+    SharedBuffer prefix;   // spliced between header and body, counted in the header's length
+    uint16_t topic {};     // delivered to this topic's subscribers only
+
+    size_t size() const noexcept { return frame.size() + prefix.size(); }
+};
+
+// The most recent broadcasts, oldest first, bounded by count and by bytes. Slots are handles in one
+// contiguous array, so keeping a message and replaying it to a late joiner copies no payload.
+class History {
 public:
-    int32_t const domain = Domain;
+    History(size_t max_messages, size_t max_bytes) noexcept
+        : m_slots(max_messages)
+        , m_max_bytes { max_bytes }
+    {
+    }
 
-    TCPServer(char const* ip_addr, uint16_t port_num, uint16_t listeners) noexcept
-        : m_ACC_SOCK { socket(Domain, SOCK_STREAM, Protocol) }
+    void push(Broadcast const& message) noexcept
     {
-        if (m_ACC_SOCK == -1) {
-            std::fprintf(stderr, "Could not create socket for TCPServer\n");
-            std::fflush(stderr);
+        if (m_slots.empty() || message.size() > m_max_bytes) {
             return;
         }
+        while (m_count == m_slots.size() || (m_count > 0 && m_bytes + message.size() > m_max_bytes)) {
+            m_pop();
+        }
+        m_slots[(m_head + m_count) % m_slots.size()] = message;
+        m_bytes += message.size();
+        ++m_count;
+    }
 
-        m_TCPServer_address.sin_family = Domain;
-        inet_pton(Domain, ip_addr, &m_TCPServer_address.sin_addr);
-        m_TCPServer_address.sin_port = htons(port_num);
-
-        if (bind(m_ACC_SOCK, reinterpret_cast<sockaddr*>(&m_TCPServer_address), sizeof(m_TCPServer_address)) == -1) {
-            std::fprintf(stderr, "Could not bind TCPServer to the given address\n");
-            std::fflush(stderr);
-            return;
+    template <typename Visit>
+    void for_each(Visit&& visit) const noexcept
+    {
+        for (size_t index {}; index < m_count; ++index) {
+            visit(m_slots[(m_head + index) % m_slots.size()]);
         }
+    }
 
-        if (listen(m_ACC_SOCK, listeners) == -1) {
-            std::fprintf(stderr, "Could not listen on given PORT and IP\n");
+    size_t bytes() const noexcept { return m_bytes; }
+
+private:
+    void m_pop() noexcept
+    {
+        m_bytes -= m_slots[m_head].size();
+        m_slots[m_head] = {};
+        m_head          = (m_head + 1) % m_slots.size();
+        --m_count;
+    }
+
+    std::vector<Broadcast> m_slots;
+    size_t const m_max_bytes;
+    size_t m_head {};
+    size_t m_count {};
+    size_t m_bytes {};
+};
+
+// A run of bytes inside a shared buffer, the unit of an outbound queue
+struct Slice {
+    SharedBuffer buffer;
+    uint32_t offset;
+    uint32_t length;
+    bool first;   // starts a message
+};
+
+template <int32_t Domain, int32_t Protocol = 0>
+class TCPServer {
+public:
+    int32_t const domain = Domain;
+
+    TCPServer(char const* ip_addr, uint16_t port_num, uint16_t listeners, Backend backend = _DEFAULT_BACKEND_, uint16_t threads = 1, FanOutPolicy policy = {}) noexcept
+        : m_policy { policy }
+    {
+        if (!m_TCPServer_address.parse(ip_addr, port_num)) {
+            std::fprintf(stderr, "Invalid address %s for TCPServer\n", ip_addr);
             std::fflush(stderr);
             return;
         }
+        m_TCPServer_address.unlink();
 
-        m_pollfd_set[FD_INDEX::STDIN]  = { STDIN_FILENO, POLLIN };
-        m_pollfd_set[FD_INDEX::ACCEPT] = { m_ACC_SOCK, POLLIN };
+        threads = std::max<uint16_t>(threads, 1);
+        for (uint16_t shard_id {}; shard_id < threads; ++shard_id) {
+            m_shards.emplace_back(new Shard { *this, shard_id, backend });
+            bool reuse_port = SocketAddress<Domain>::s_REUSE_PORT;
+            bool ready      = reuse_port || shard_id == 0 ? m_shards.back()->listen_on(listeners, reuse_port && threads > 1)
+                                                          : m_shards.back()->share_listener(*m_shards[0]);
+            if (!ready) {
+                m_shards.clear();
+                return;
+            }
+        }
 
-        std::fprintf(stdout, "TCPServer listening on %s:%d\n", ip_addr, port_num);
+        std::fprintf(stdout, "TCPServer listening on %s using %s x %d\n", m_TCPServer_address.describe().c_str(), m_shards[0]->backend_name(), threads);
+        std::fflush(stdout);
     }
 
     TCPServer(TCPServer const&)             = delete;
@@ -53,161 +166,1159 @@ public:
 
     void start(int32_t tout_in_mill = 1000) noexcept
     {
-        for (int32_t poll_stat; !m_close_conn;) {
-            poll_stat = poll(m_pollfd_set.data(), 2 + m_conns, tout_in_mill);
-            if (poll_stat == -1) {
-                std::fprintf(stderr, "Polling failed\n");
+        if (m_shards.empty()) {
+            return;
+        }
+        std::vector<std::thread> reactors;
+        for (size_t shard_id { 1 }; shard_id < m_shards.size(); ++shard_id) {
+            reactors.emplace_back([this, shard_id, tout_in_mill] { m_shards[shard_id]->run(tout_in_mill); });
+        }
+        std::thread scraper;
+        if (m_metrics_sock != -1) {
+            scraper = std::thread { [this] { m_serve_metrics(); } };
+        }
+        m_shards[0]->run(tout_in_mill);
+
+        m_close_conn.store(true, std::memory_order_relaxed);
+        for (auto& shard : m_shards) {
+            shard->wake();
+        }
+        for (std::thread& reactor : reactors) {
+            reactor.join();
+        }
+        if (scraper.joinable()) {
+            shutdown(m_metrics_sock, SHUT_RDWR);
+            scraper.join();
+        }
+    }
+
+    ~TCPServer() noexcept
+    {
+        if (m_metrics_sock != -1) {
+            close(m_metrics_sock);
+            m_metrics_address.unlink();
+        }
+        if (!m_shards.empty()) {
+            m_shards.clear();
+            m_TCPServer_address.unlink();
+        }
+    }
+
+    // Serves the counters in Prometheus text format on a UNIX socket; a path starting with '@' names an abstract socket
+    bool expose_metrics(char const* path) noexcept
+    {
+        if (!m_metrics_address.parse(path, 0)) {
+            std::fprintf(stderr, "Invalid metrics socket path %s\n", path);
+            std::fflush(stderr);
+            return false;
+        }
+        m_metrics_address.unlink();
+
+        m_metrics_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_metrics_sock == -1 || bind(m_metrics_sock, m_metrics_address.get(), m_metrics_address.size()) == -1 || listen(m_metrics_sock, 16) == -1) {
+            std::fprintf(stderr, "Could not serve metrics on %s\n", path);
+            std::fflush(stderr);
+            if (m_metrics_sock != -1) {
+                close(m_metrics_sock);
+                m_metrics_sock = -1;
+            }
+            return false;
+        }
+        std::fprintf(stdout, "TCPServer metrics on %s\n", m_metrics_address.describe().c_str());
+        std::fflush(stdout);
+        return true;
+    }
+
+    static constexpr uint16_t s_MAX_BUFFER_SIZE { 1024 };
+    static constexpr uint16_t s_MAX_UNAME_SIZE { 64 };
+
+private:
+    // One reactor thread: its own SO_REUSEPORT listener, client set and inbox for broadcasts from other shards
+    class Shard {
+    public:
+        Shard(TCPServer& server, uint16_t shard_id, Backend backend) noexcept
+            : m_server { server }
+            , m_ID { shard_id }
+            , m_ACC_SOCK { socket(Domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, Protocol) }
+            , m_WAKE_FD { eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
+            , m_reactor { Reactor::create(backend) }
+            , m_inbox { s_INBOX_SIZE }
+            , m_history { server.m_policy.history_messages, server.m_policy.history_bytes }
+            , m_ping { s_control_frame(FrameType::PING) }
+            , m_pong { s_control_frame(FrameType::PONG) }
+        {
+        }
+
+        ~Shard() noexcept
+        {
+            for (int32_t client_sock : m_clients) {
+                close(client_sock);
+            }
+            if (m_ACC_SOCK != -1) {
+                close(m_ACC_SOCK);
+            }
+            if (m_WAKE_FD != -1) {
+                close(m_WAKE_FD);
+            }
+        }
+
+        bool listen_on(uint16_t listeners, bool reuse_port) noexcept
+        {
+            if (m_ACC_SOCK == -1 || m_WAKE_FD == -1) {
+                std::fprintf(stderr, "Could not create socket for TCPServer\n");
                 std::fflush(stderr);
-                return;
+                return false;
             }
-            if (poll_stat > 0) {
-                if (m_pollfd_set[FD_INDEX::ACCEPT].revents & POLLIN) {
-                    m_accept_conn() ? m_broadcast(FD_INDEX::CLIENTS + m_conns - 1) : void();
-                    continue;
+
+            int32_t enable { 1 };
+            if (reuse_port && setsockopt(m_ACC_SOCK, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+                std::fprintf(stderr, "Could not enable SO_REUSEPORT\n");
+                std::fflush(stderr);
+                return false;
+            }
+
+            if (bind(m_ACC_SOCK, m_server.m_TCPServer_address.get(), m_server.m_TCPServer_address.size()) == -1) {
+                std::fprintf(stderr, "Could not bind TCPServer to the given address\n");
+                std::fflush(stderr);
+                return false;
+            }
+
+            if (listen(m_ACC_SOCK, listeners) == -1) {
+                std::fprintf(stderr, "Could not listen on given PORT and IP\n");
+                std::fflush(stderr);
+                return false;
+            }
+
+            m_register();
+            return true;
+        }
+
+        // Families without SO_REUSEPORT: every shard polls the first shard's listener. The shards that lose
+        // the race for a connection see EAGAIN, as any listener does once its backlog is drained.
+        bool share_listener(Shard const& first) noexcept
+        {
+            if (m_ACC_SOCK == -1 || m_WAKE_FD == -1 || dup3(first.m_ACC_SOCK, m_ACC_SOCK, O_CLOEXEC) == -1) {
+                std::fprintf(stderr, "Could not share the TCPServer listener\n");
+                std::fflush(stderr);
+                return false;
+            }
+            m_register();
+            return true;
+        }
+
+        char const* backend_name() const noexcept { return m_reactor->name(); }
+        ShardMetrics const& metrics() const noexcept { return m_metrics; }
+
+        // Asks the shard to list its connections from its own thread, the only one allowed to read them
+        void request_dump() noexcept
+        {
+            m_dump_requested.store(true, std::memory_order_relaxed);
+            wake();
+        }
+
+        void wake() noexcept
+        {
+            uint64_t one { 1 };
+            [[maybe_unused]] ssize_t n = write(m_WAKE_FD, &one, sizeof(one));
+        }
+
+        bool deliver(Broadcast&& message) noexcept
+        {
+            if (!m_inbox.push(std::move(message))) {
+                return false;
+            }
+            wake();
+            return true;
+        }
+
+        void run(int32_t tout_in_mill) noexcept
+        {
+            while (!m_server.m_close_conn.load(std::memory_order_relaxed)) {
+                if (m_reactor->wait(m_timers.timeout_ms(std::chrono::steady_clock::now(), tout_in_mill)) == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    std::fprintf(stderr, "Polling failed\n");
+                    std::fflush(stderr);
+                    return;
                 }
-                if (m_pollfd_set[FD_INDEX::STDIN].revents & POLLIN) {
-                    int32_t msg_len         = read(m_pollfd_set[FD_INDEX::STDIN].fd, m_write_buffer.data(), s_MAX_BUFFER_SIZE);
-                    m_write_buffer[msg_len] = 0;
-                    if (m_write_buffer[0] == '0') {
-                        std::fputs("Shutting Down TCPServer\n", stdout);
-                        std::fflush(stdout);
-                        m_close_conn = true;
-                        break;
+                auto woke = std::chrono::steady_clock::now();
+                m_now     = woke;
+                for (ReactorEvent const& event : *m_reactor) {
+                    if (event.flags & EV_ACCEPT) {
+                        m_admit(event.result);
+                    } else if (event.fd == m_ACC_SOCK) {
+                        m_accept_conn();
+                    } else if (event.fd == m_WAKE_FD) {
+                        m_drain_inbox();
+                    } else if (event.fd == STDIN_FILENO) {
+                        m_read_stdin();
+                    } else {
+                        if (event.flags & EV_SENT) {
+                            m_on_sent(event.fd, event.result);
+                        }
+                        if (event.flags & EV_DATA) {
+                            m_on_data(event.fd, event.data, event.result);
+                        }
+                        if (event.flags & EV_WRITE) {
+                            m_flush(event.fd);
+                        }
+                        if (event.flags & (EV_READ | EV_HANGUP | EV_ERROR)) {
+                            m_read_client(event.fd);
+                        }
                     }
-                    m_broadcast(0);
-                    continue;
+                    m_reap();
+                    if (m_server.m_close_conn.load(std::memory_order_relaxed)) {
+                        return;
+                    }
+                }
+                for (int32_t client_sock : m_pending_flush) {
+                    m_sessions[client_sock].flush_pending = false;
+                    m_flush(client_sock);
                 }
-                for (auto* client_ptr = m_pollfd_set.begin() + FD_INDEX::CLIENTS; client_ptr < m_pollfd_set.begin() + FD_INDEX::CLIENTS + m_conns; ++client_ptr) {
-                    if (client_ptr->revents & POLLIN) {
-                        m_read_client(client_ptr - m_pollfd_set.begin()) ? m_broadcast(client_ptr - m_pollfd_set.begin()) : void();
+                m_pending_flush.clear();
+                m_now = std::chrono::steady_clock::now();
+                m_timers.advance(m_now, [this](uint64_t client_sock) { m_on_timer(static_cast<int32_t>(client_sock)); });
+                m_metrics.timers.set(m_timers.size());
+                m_reap();
+                m_metrics.loop_iterations.add();
+                m_metrics.loop_latency.record(std::chrono::steady_clock::now() - woke);
+            }
+        }
+
+    private:
+        void m_register() noexcept
+        {
+            if (m_ID == 0) {
+                m_reactor->add(STDIN_FILENO, EV_READ);
+            }
+            m_reactor->add_listener(m_ACC_SOCK);
+            m_reactor->add(m_WAKE_FD, EV_READ);
+        }
+
+        // Where a client sits in one topic's subscriber vector, so leaving is a swap with the last entry
+        struct Subscription {
+            uint16_t topic;
+            uint32_t position;
+        };
+
+        struct Session {
+            std::string uname;
+            uint32_t id {};
+            int32_t slot { -1 };   // position in m_clients, -1 when fd is not a connected client
+            bool greeted {};       // HELLO received; until then the connection only counts as a handshake
+            bool pinged {};        // a heartbeat PING went out since the client was last heard from
+            TimingWheel::TimerId timer { TimingWheel::s_NONE };
+            TimingWheel::Clock::time_point last_heard;
+            SharedBuffer prefix;   // "Message from [uname]: "
+            std::deque<Slice> outbound;
+            size_t head_offset {};    // bytes of outbound.front() already written
+            size_t queued_bytes {};   // bytes still waiting in outbound
+            bool want_write {};       // EV_WRITE currently registered
+            uint16_t inflight {};     // sends submitted to a completion backend
+            bool flush_pending {};    // listed in m_pending_flush
+            bool dropping {};         // crossed high water under SlowConsumer::DROP
+            bool corked {};           // TCP_CORK set under SegmentPolicy::CORK
+            bool doomed {};
+            std::unique_ptr<FrameParser> parser;
+            ConnectionMetrics metrics;
+            std::vector<Subscription> topics;
+        };
+
+        // Drains the whole backlog, so a reconnect storm costs one wakeup rather than one per connection
+        void m_accept_conn() noexcept
+        {
+            for (;;) {
+                int32_t client_sock = accept4(m_ACC_SOCK, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client_sock == -1) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        std::fprintf(stderr, "Could not accept connection\n");
+                        std::fflush(stderr);
                     }
+                    return;
                 }
+                m_admit(client_sock);
             }
         }
-    }
 
-    ~TCPServer() noexcept
-    {
-        std::for_each_n(m_pollfd_set.begin(), m_conns + FD_INDEX::CLIENTS, [](pollfd const& poll_fd) {
-            close(poll_fd.fd);
-        });
-    }
+        // Nothing is read here: the HELLO frame is handled by m_greet whenever it arrives, like any other frame,
+        // and a connection that stays silent past its deadline is closed by m_on_timer
+        void m_admit(int32_t client_sock) noexcept
+        {
+            if (SocketAddress<Domain>::s_TCP && m_server.m_policy.segments != SegmentPolicy::NAGLE) {
+                int32_t enable { 1 };
+                setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            }
+            if (!m_reactor->add_stream(client_sock)) {
+                std::fprintf(stderr, "Could not register connection with %s\n", m_reactor->name());
+                std::fflush(stderr);
+                close(client_sock);
+                return;
+            }
 
-private:
-    bool m_accept_conn() noexcept
-    {
-        if (m_conns < s_MAX_CONNS) {
-            int32_t client_sock = accept(m_ACC_SOCK, nullptr, nullptr);
-            if (client_sock == -1) {
-                std::fprintf(stderr, "Could not accept connection\n");
+            if (static_cast<size_t>(client_sock) >= m_sessions.size()) {
+                m_sessions.resize(client_sock + 1);
+            }
+            Session& session = m_sessions[client_sock];
+            session.id       = m_server.m_next_id.fetch_add(1, std::memory_order_relaxed);
+            session.slot     = static_cast<int32_t>(m_clients.size());
+            session.parser   = std::make_unique<FrameParser>();
+            m_clients.push_back(client_sock);
+            session.last_heard = m_now;
+            session.timer      = m_timers.schedule(m_now + m_server.m_policy.handshake_timeout, client_sock);
+            m_metrics.handshakes.add();
+        }
+
+        // The username arrives as a HELLO frame; anything the client pipelined behind it stays in the parser
+        void m_greet(int32_t client_sock, char const* uname, uint32_t len) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            session.greeted  = true;
+            session.uname.assign(uname, std::min<size_t>(len, s_MAX_UNAME_SIZE));
+            std::string prefix = "Message from [" + session.uname + "]: ";
+            session.prefix     = SharedBuffer::make(prefix.data(), prefix.size());
+            m_metrics.handshakes.sub(1);
+            m_metrics.accepted.add();
+            m_metrics.connections.add();
+            m_timers.cancel(session.timer);
+            m_arm_timer(client_sock);
+
+            // Everyone starts in the lobby. Its backlog is queued like any broadcast, so it leaves in the end-of-iteration
+            // flush as gathered writes of shared buffers and a client that cannot take it all waits on EV_WRITE, not the loop
+            m_subscribe(client_sock, 0);
+
+            char const* notice = m_compose(FrameType::NOTICE, 0, "[%s] connected\n", session.uname.c_str());
+            LOG_INFO(notice, std::strlen(notice), "");
+            m_publish(client_sock);
+        }
+
+        // One timer per connection, due at the nearest of its heartbeat and idle deadlines. Traffic only stamps
+        // last_heard, so a busy client is never rescheduled; the timer re-arms itself from that stamp when it fires.
+        void m_arm_timer(int32_t client_sock) noexcept
+        {
+            Session& session           = m_sessions[client_sock];
+            FanOutPolicy const& policy = m_server.m_policy;
+            auto due                   = TimingWheel::Clock::time_point::max();
+            if (policy.heartbeat.count() > 0 && !session.pinged) {
+                due = session.last_heard + policy.heartbeat;
+            }
+            if (policy.idle_timeout.count() > 0) {
+                due = std::min(due, session.last_heard + policy.idle_timeout);
+            }
+            session.timer = due == TimingWheel::Clock::time_point::max() ? TimingWheel::s_NONE : m_timers.schedule(due, client_sock);
+        }
+
+        void m_on_timer(int32_t client_sock) noexcept
+        {
+            Session& session           = m_sessions[client_sock];
+            FanOutPolicy const& policy = m_server.m_policy;
+            session.timer              = TimingWheel::s_NONE;
+            if (!session.greeted) {
+                std::fprintf(stderr, "No HELLO from new connection in %lld ms\n", static_cast<long long>(policy.handshake_timeout.count()));
                 std::fflush(stderr);
-                return false;
+                m_metrics.handshake_timeouts.add();
+                m_doom(client_sock);
+                return;
             }
-            int32_t uname_size = recv(client_sock, m_read_buffer.data(), s_MAX_BUFFER_SIZE, 0);
-            if (uname_size == -1) {
-                std::fprintf(stderr, "Could not receive username");
+            auto silence = m_now - session.last_heard;
+            if (policy.idle_timeout.count() > 0 && silence >= policy.idle_timeout) {
+                std::fprintf(stderr, "Disconnecting idle client [%s]\n", session.uname.c_str());
                 std::fflush(stderr);
+                m_metrics.idle_timeouts.add();
+                m_doom(client_sock);
+                return;
+            }
+            if (policy.heartbeat.count() > 0 && !session.pinged && silence >= policy.heartbeat) {
+                m_enqueue(client_sock, { m_ping, {} });
+                session.pinged = true;
+                m_metrics.heartbeats.add();
+            }
+            m_arm_timer(client_sock);
+        }
+
+        static SharedBuffer s_control_frame(FrameType type) noexcept
+        {
+            char frame[s_FRAME_HEADER_SIZE];
+            EncodeHeader(frame, type, 0, 0);
+            return SharedBuffer::make(frame, sizeof(frame));
+        }
+
+        void m_read_stdin() noexcept
+        {
+            char* line      = m_write_buffer.data() + s_FRAME_HEADER_SIZE;
+            int32_t msg_len = read(STDIN_FILENO, line, s_MAX_BUFFER_SIZE);
+            if (msg_len <= 0) {
+                return;
+            }
+            if (line[0] == '0') {
+                LogToStdOut("Shutting Down TCPServer");
+                m_server.m_close_conn.store(true, std::memory_order_relaxed);
+                return;
+            }
+            if (msg_len >= 5 && std::strncmp(line, "stats", 5) == 0 && (msg_len == 5 || line[5] == '\n')) {
+                m_server.m_log_stats();
+                return;
+            }
+            EncodeHeader(m_write_buffer.data(), FrameType::NOTICE, 0, msg_len);
+            m_write_len = s_FRAME_HEADER_SIZE + msg_len;
+            m_publish(-1);
+        }
+
+        // Edge-triggered sockets only report new data once, so keep reading until the kernel buffer is empty.
+        // Each readv may carry many frames, or only part of one; the parser stitches them back together.
+        void m_read_client(int32_t client_sock) noexcept
+        {
+            if (static_cast<size_t>(client_sock) >= m_sessions.size() || m_sessions[client_sock].slot == -1) {
+                return;
             }
-            int32_t msg_len         = std::sprintf(m_write_buffer.data(), "[%.*s] connected\n", uname_size, m_read_buffer.data());
-            m_write_buffer[msg_len] = 0;
+            for (;;) {
+                ssize_t read_bytes = m_sessions[client_sock].parser->fill(client_sock);
+                if (read_bytes == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return;
+                    }
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    std::fprintf(stderr, "Could not receive complete message\n");
+                    std::fflush(stderr);
+                }
+                if (read_bytes > 0) {
+                    m_sessions[client_sock].metrics.bytes_in += read_bytes;
+                    m_metrics.bytes_in.add(read_bytes);
+                }
+                if (read_bytes <= 0 || !m_handle_frames(client_sock)) {
+                    m_doom(client_sock);
+                    return;
+                }
+            }
+        }
 
-            m_client_uname_sock_map[client_sock].assign(m_read_buffer.data(), uname_size);
-            m_pollfd_set[FD_INDEX::CLIENTS + m_conns].fd     = client_sock;
-            m_pollfd_set[FD_INDEX::CLIENTS + m_conns].events = POLLIN;
-            m_conns++;
+        // Completion backends deliver bytes already received into a provided buffer
+        void m_on_data(int32_t client_sock, char const* data, int32_t len) noexcept
+        {
+            if (static_cast<size_t>(client_sock) >= m_sessions.size() || m_sessions[client_sock].slot == -1) {
+                return;
+            }
+            if (len <= 0) {
+                m_doom(client_sock);
+                return;
+            }
+            m_sessions[client_sock].metrics.bytes_in += len;
+            m_metrics.bytes_in.add(len);
+            while (len > 0) {
+                size_t fed = m_sessions[client_sock].parser->feed(data, len);
+                data += fed;
+                len -= static_cast<int32_t>(fed);
+                if (!m_handle_frames(client_sock) || (fed == 0 && len > 0)) {
+                    m_doom(client_sock);
+                    return;
+                }
+            }
+        }
 
-            std::fputs(m_write_buffer.data(), stdout);
-            std::fflush(stdout);
+        bool m_handle_frames(int32_t client_sock) noexcept
+        {
+            Session& session   = m_sessions[client_sock];
+            session.last_heard = m_now;
+            if (session.pinged) {
+                // The timer was left waiting for the idle deadline alone; bring the next heartbeat back in
+                session.pinged = false;
+                m_timers.cancel(session.timer);
+                m_arm_timer(client_sock);
+            }
+            FrameHeader header;
+            char const* payload;
+            while (session.parser->next(header, payload)) {
+                if (!session.greeted) {
+                    if (header.type != FrameType::HELLO || header.length == 0) {
+                        std::fprintf(stderr, "Expected HELLO frame from new connection\n");
+                        std::fflush(stderr);
+                        return false;
+                    }
+                    m_greet(client_sock, payload, header.length);
+                } else if (header.type == FrameType::CHAT) {
+                    ++session.metrics.messages_in;
+                    m_metrics.messages_in.add();
+                    m_publish_chat(client_sock, header.topic, payload, header.length);
+                } else if (header.type == FrameType::JOIN) {
+                    m_subscribe(client_sock, header.topic);
+                } else if (header.type == FrameType::LEAVE) {
+                    m_unsubscribe(client_sock, header.topic);
+                } else if (header.type == FrameType::PING) {
+                    m_enqueue(client_sock, { m_pong, {} });
+                }
+            }
+            if (session.parser->error()) {
+                std::fprintf(stderr, "Malformed frame from [%s]\n", session.uname.c_str());
+                std::fflush(stderr);
+                return false;
+            }
             return true;
         }
-        std::fprintf(stdout, "Maximum number of connections reached\n");
-        return false;
-    }
 
-    bool m_read_client(int32_t client_index) noexcept
-    {
-        int32_t read_bytes = recv(m_pollfd_set[client_index].fd, m_read_buffer.data(), m_read_buffer.size(), 0);
-        if (read_bytes == -1) {
-            std::fprintf(stderr, "Could not receive complete message\n");
-            std::fflush(stderr);
-            return false;
+        // Formats a payload into m_write_buffer behind a frame header, returns the payload for local logging
+        template <typename... Args>
+        char const* m_compose(FrameType type, uint32_t sender, char const* format, Args... args) noexcept
+        {
+            char* payload = m_write_buffer.data() + s_FRAME_HEADER_SIZE;
+            int32_t len   = std::clamp(std::snprintf(payload, s_MAX_PAYLOAD + 1, format, args...), 0, static_cast<int32_t>(s_MAX_PAYLOAD));
+            EncodeHeader(m_write_buffer.data(), type, sender, len);
+            m_write_len = s_FRAME_HEADER_SIZE + len;
+            return payload;
         }
-        if (read_bytes == 0) {
-            int32_t msg_len         = std::sprintf(m_write_buffer.data(), "[%s] disconnected\n", m_client_uname_sock_map[m_pollfd_set[client_index].fd].c_str());
-            m_write_buffer[msg_len] = 0;
 
-            m_close_client(client_index);
+        inline void m_close_client(int32_t client_sock) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            m_reactor->remove(client_sock);
+            close(client_sock);
+            m_timers.cancel(session.timer);
+            m_metrics.queued_bytes.sub(session.queued_bytes);
+            if (session.greeted) {
+                m_metrics.connections.sub(1);
+                m_metrics.closed.add();
+            } else {
+                m_metrics.handshakes.sub(1);
+            }
 
-            std::fputs(m_write_buffer.data(), stdout);
-            std::fflush(stdout);
+            while (!session.topics.empty()) {
+                m_unsubscribe(client_sock, session.topics.back().topic);
+            }
+            m_clients[session.slot]           = m_clients.back();
+            m_sessions[m_clients.back()].slot = session.slot;
+            m_clients.pop_back();
+            session = Session {};
+        }
 
-            return true;
+        // Joining also replays the topic's share of the history, so a room is never entered mid-conversation
+        void m_subscribe(int32_t client_sock, uint16_t topic) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            for (Subscription const& subscription : session.topics) {
+                if (subscription.topic == topic) {
+                    return;
+                }
+            }
+            if (topic >= m_subscribers.size()) {
+                m_subscribers.resize(topic + 1);
+            }
+            session.topics.push_back({ topic, static_cast<uint32_t>(m_subscribers[topic].size()) });
+            m_subscribers[topic].push_back(client_sock);
+            m_history.for_each([&](Broadcast const& message) {
+                if (message.topic == topic) {
+                    m_enqueue(client_sock, message);
+                }
+            });
+        }
+
+        void m_unsubscribe(int32_t client_sock, uint16_t topic) noexcept
+        {
+            std::vector<Subscription>& topics = m_sessions[client_sock].topics;
+            auto subscription                 = std::find_if(topics.begin(), topics.end(), [topic](Subscription const& entry) { return entry.topic == topic; });
+            if (subscription == topics.end()) {
+                return;
+            }
+            std::vector<int32_t>& subscribers   = m_subscribers[topic];
+            int32_t moved                       = subscribers.back();
+            subscribers[subscription->position] = moved;
+            subscribers.pop_back();
+            for (Subscription& entry : m_sessions[moved].topics) {
+                if (entry.topic == topic) {
+                    entry.position = subscription->position;
+                    break;
+                }
+            }
+            *subscription = topics.back();
+            topics.pop_back();
+        }
+
+        void m_doom(int32_t client_sock) noexcept
+        {
+            if (!m_sessions[client_sock].doomed) {
+                m_sessions[client_sock].doomed = true;
+                m_doomed.push_back(client_sock);
+            }
+        }
+
+        // Clients that failed or fell too far behind during fan-out are closed here, outside the m_clients walk
+        void m_reap() noexcept
+        {
+            while (!m_doomed.empty()) {
+                int32_t client_sock = m_doomed.back();
+                m_doomed.pop_back();
+                if (m_sessions[client_sock].slot == -1) {
+                    continue;
+                }
+                if (!m_sessions[client_sock].greeted) {
+                    m_close_client(client_sock);
+                    continue;
+                }
+                char const* notice = m_compose(FrameType::NOTICE, 0, "[%s] disconnected\n", m_sessions[client_sock].uname.c_str());
+                m_close_client(client_sock);
+
+                LOG_INFO(notice, std::strlen(notice), "");
+
+                m_publish(-1);
+            }
+        }
+
+        // Queues the message's slices; every client is flushed once at the end of the loop iteration, so all
+        // broadcasts produced in between leave in one vectored write (or one linked chain on io_uring)
+        void m_enqueue(int32_t client_sock, Broadcast const& message) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            if (session.doomed || session.dropping) {
+                return;
+            }
+            uint32_t frame_size = static_cast<uint32_t>(message.frame.size());
+            if (message.prefix) {
+                session.outbound.push_back({ message.frame, 0, static_cast<uint32_t>(s_FRAME_HEADER_SIZE), true });
+                session.outbound.push_back({ message.prefix, 0, static_cast<uint32_t>(message.prefix.size()), false });
+                session.outbound.push_back({ message.frame, static_cast<uint32_t>(s_FRAME_HEADER_SIZE), frame_size - static_cast<uint32_t>(s_FRAME_HEADER_SIZE), false });
+            } else {
+                session.outbound.push_back({ message.frame, 0, frame_size, true });
+            }
+            session.queued_bytes += message.size();
+            ++session.metrics.messages_out;
+            m_metrics.messages_out.add();
+            m_metrics.queued_bytes.add(message.size());
+            if (!session.flush_pending) {
+                session.flush_pending = true;
+                m_pending_flush.push_back(client_sock);
+            }
+        }
+
+        void m_on_slow_consumer(int32_t client_sock) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            if (!session.dropping) {
+                m_metrics.slow_consumers.add();
+            }
+            if (m_server.m_policy.on_slow == SlowConsumer::DISCONNECT) {
+                std::fprintf(stderr, "Disconnecting slow consumer [%s]\n", session.uname.c_str());
+                std::fflush(stderr);
+                m_doom(client_sock);
+            } else if (!session.dropping) {
+                std::fprintf(stderr, "Dropping broadcasts for slow consumer [%s]\n", session.uname.c_str());
+                std::fflush(stderr);
+                session.dropping = true;
+            }
+        }
+
+        // Write as much of the outbound queue as the socket takes; EV_WRITE stays registered only while a backlog remains
+        void m_flush(int32_t client_sock) noexcept
+        {
+            if (static_cast<size_t>(client_sock) >= m_sessions.size() || m_sessions[client_sock].slot == -1) {
+                return;
+            }
+            Session& session = m_sessions[client_sock];
+            if (session.outbound.empty() || session.doomed) {
+                return;
+            }
+            m_cork(client_sock, true);
+            if (m_reactor->completion_based()) {
+                if (session.inflight == 0) {
+                    size_t chain = std::min(session.outbound.size(), s_MAX_LINKED_SENDS);
+                    for (size_t index {}; index < chain; ++index) {
+                        Slice const& slice = session.outbound[index];
+                        size_t skip        = index == 0 ? session.head_offset : 0;
+                        if (!m_reactor->submit_send(client_sock, slice.buffer, slice.offset + skip, slice.length - skip, index + 1 < chain)) {
+                            break;
+                        }
+                        ++session.inflight;
+                    }
+                }
+            } else {
+                m_write_outbound(client_sock);
+            }
+
+            // Bytes already handed to the kernel are not backlog; what waits behind them is judged against the
+            // high water mark and, when dropping, trimmed from the newest end
+            if (session.queued_bytes > m_server.m_policy.high_water && !session.doomed && s_backlog(session) > m_server.m_policy.high_water) {
+                m_on_slow_consumer(client_sock);
+                if (session.dropping) {
+                    m_trim(session);
+                }
+            }
+            if (!m_reactor->completion_based()) {
+                if (session.dropping && session.queued_bytes <= m_server.m_policy.low_water) {
+                    session.dropping = false;
+                }
+                if (session.outbound.empty()) {
+                    m_cork(client_sock, false);
+                }
+                bool want_write = !session.outbound.empty() && !session.doomed;
+                if (want_write != session.want_write) {
+                    session.want_write = want_write;
+                    m_reactor->modify(client_sock, EV_READ | EV_EDGE | (want_write ? EV_WRITE : 0U));
+                }
+            }
+        }
+
+        // Readiness backends: gather up to s_MAX_IOV slices per sendmsg until the queue is empty or the socket is full
+        void m_write_outbound(int32_t client_sock) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            iovec iov[s_MAX_IOV];
+            while (!session.outbound.empty() && !session.doomed) {
+                int32_t count {};
+                size_t total {};
+                for (auto slice = session.outbound.begin(); slice != session.outbound.end() && count < s_MAX_IOV; ++slice, ++count) {
+                    size_t skip = count == 0 ? session.head_offset : 0;
+                    iov[count]  = { const_cast<char*>(slice->buffer.data()) + slice->offset + skip, slice->length - skip };
+                    total += slice->length - skip;
+                }
+                msghdr message {};
+                message.msg_iov    = iov;
+                message.msg_iovlen = count;
+                ssize_t send_bytes = sendmsg(client_sock, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (send_bytes == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        ++session.metrics.send_errors;
+                        m_metrics.send_errors.add();
+                        m_doom(client_sock);
+                    }
+                    return;
+                }
+                m_consume(session, send_bytes);
+                if (static_cast<size_t>(send_bytes) < total) {
+                    return;   // socket buffer full, EV_WRITE resumes
+                }
+            }
+        }
+
+        // Retires `bytes` written from the head of the queue
+        void m_consume(Session& session, size_t bytes) noexcept
+        {
+            session.queued_bytes -= bytes;
+            session.metrics.bytes_out += bytes;
+            m_metrics.bytes_out.add(bytes);
+            m_metrics.queued_bytes.sub(bytes);
+            while (bytes > 0) {
+                size_t left = session.outbound.front().length - session.head_offset;
+                if (bytes < left) {
+                    session.head_offset += bytes;
+                    return;
+                }
+                bytes -= left;
+                session.outbound.pop_front();
+                session.head_offset = 0;
+            }
+        }
+
+        // Drops whole messages, newest first, down to low water. Slices that are partly written or already
+        // submitted stay, and so does the rest of their message, so the stream never carries a torn frame.
+        void m_trim(Session& session) noexcept
+        {
+            size_t keep = std::max<size_t>(session.inflight, session.head_offset > 0 ? 1 : 0);
+            while (session.queued_bytes > m_server.m_policy.low_water && !session.outbound.empty()) {
+                size_t first = session.outbound.size() - 1;
+                while (first > 0 && !session.outbound[first].first) {
+                    --first;
+                }
+                if (first < keep) {
+                    return;
+                }
+                while (session.outbound.size() > first) {
+                    session.queued_bytes -= session.outbound.back().length;
+                    m_metrics.queued_bytes.sub(session.outbound.back().length);
+                    session.outbound.pop_back();
+                }
+            }
+        }
+
+        // Under SegmentPolicy::CORK only full segments leave while a client has a backlog; the tail goes out
+        // once its queue drains
+        void m_cork(int32_t client_sock, bool cork) noexcept
+        {
+            Session& session = m_sessions[client_sock];
+            if (!SocketAddress<Domain>::s_TCP || m_server.m_policy.segments != SegmentPolicy::CORK || session.corked == cork) {
+                return;
+            }
+            int32_t value { cork };
+            setsockopt(client_sock, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+            session.corked = cork;
+        }
+
+        static size_t s_backlog(Session const& session) noexcept
+        {
+            size_t backlog {};
+            for (size_t index = session.inflight; index < session.outbound.size(); ++index) {
+                backlog += session.outbound[index].length;
+            }
+            return backlog;
+        }
+
+        // Linked sends complete in submission order. Each carries MSG_WAITALL, so a send that ends short
+        // completes with the bytes it did write and fails the link, and the rest of the chain arrives as
+        // -ECANCELED; it is resubmitted from the new head offset once every completion is in.
+        void m_on_sent(int32_t client_sock, int32_t result) noexcept
+        {
+            if (static_cast<size_t>(client_sock) >= m_sessions.size() || m_sessions[client_sock].slot == -1) {
+                return;
+            }
+            Session& session = m_sessions[client_sock];
+            --session.inflight;
+            if (result > 0) {
+                m_consume(session, result);
+            } else if (result != -ECANCELED && result != -EAGAIN) {
+                ++session.metrics.send_errors;
+                m_metrics.send_errors.add();
+                m_doom(client_sock);
+                return;
+            }
+            if (session.inflight == 0) {
+                if (session.dropping && session.queued_bytes <= m_server.m_policy.low_water) {
+                    session.dropping = false;
+                }
+                if (session.outbound.empty()) {
+                    m_cork(client_sock, false);
+                }
+                m_flush(client_sock);
+            }
+        }
+
+        void m_drain_inbox() noexcept
+        {
+            uint64_t count;
+            [[maybe_unused]] ssize_t n = read(m_WAKE_FD, &count, sizeof(count));
+            for (Broadcast message; m_inbox.pop(message);) {
+                m_broadcast(message, -1);
+            }
+            if (m_dump_requested.exchange(false, std::memory_order_relaxed)) {
+                m_dump_connections();
+            }
+        }
+
+        void m_dump_connections() noexcept
+        {
+            for (int32_t client_sock : m_clients) {
+                Session const& session = m_sessions[client_sock];
+                char line[s_MAX_UNAME_SIZE + 192];
+                int32_t len = std::snprintf(line, sizeof(line),
+                                            "  shard %d fd %d [%s]: in %lu B / %lu msgs, out %lu B / %lu msgs, queued %zu B, send errors %lu",
+                                            m_ID, client_sock, session.uname.c_str(), session.metrics.bytes_in, session.metrics.messages_in,
+                                            session.metrics.bytes_out, session.metrics.messages_out, session.queued_bytes, session.metrics.send_errors);
+                LogToStdOut(line, std::clamp<int32_t>(len, 0, sizeof(line) - 1));
+            }
+        }
+
+        // Freeze m_write_buffer into one shared buffer and share it
+        void m_publish(int32_t sender_sock) noexcept
+        {
+            m_share({ SharedBuffer::make(m_write_buffer.data(), m_write_len), {} }, sender_sock);
+        }
+
+        // The body is copied once, straight from the parser behind a fresh header; the prefix is only referenced
+        void m_publish_chat(int32_t sender_sock, uint16_t topic, char const* body, uint32_t len) noexcept
+        {
+            Session const& session = m_sessions[sender_sock];
+            len                    = std::min<uint32_t>(len, s_MAX_PAYLOAD - std::min<uint32_t>(session.prefix.size(), s_MAX_PAYLOAD));
+            char header[s_FRAME_HEADER_SIZE];
+            EncodeHeader(header, FrameType::CHAT, session.id, static_cast<uint32_t>(session.prefix.size()) + len, topic);
+            m_share({ SharedBuffer::make(header, sizeof(header), body, len), session.prefix, topic }, sender_sock);
+        }
+
+        // Queue a broadcast for local clients and hand a reference to every other shard
+        void m_share(Broadcast const& message, int32_t sender_sock) noexcept
+        {
+            if (!message.frame) {
+                std::fprintf(stderr, "Could not allocate broadcast buffer\n");
+                std::fflush(stderr);
+                return;
+            }
+            m_broadcast(message, sender_sock);
+            for (auto& shard : m_server.m_shards) {
+                if (shard.get() != this && !shard->deliver(Broadcast { message })) {
+                    m_metrics.inbox_drops.add();
+                    std::fprintf(stderr, "Shard %d inbox full, dropping broadcast\n", shard->m_ID);
+                    std::fflush(stderr);
+                }
+            }
+        }
+
+        // Costs O(subscribers of the topic); a shard with none only records the message
+        void m_broadcast(Broadcast const& message, int32_t sender_sock) noexcept
+        {
+            auto started = std::chrono::steady_clock::now();
+            if (message.topic < m_subscribers.size()) {
+                for (int32_t client_sock : m_subscribers[message.topic]) {
+                    if (client_sock != sender_sock) {
+                        m_enqueue(client_sock, message);
+                    }
+                }
+            }
+            m_metrics.fanout_latency.record(std::chrono::steady_clock::now() - started);
+            if (message.prefix) {
+                m_history.push(message);
+                m_metrics.history_bytes.set(m_history.bytes());
+            }
+        }
+
+        static constexpr size_t s_INBOX_SIZE { 4096 };
+        static constexpr size_t s_MAX_LINKED_SENDS { 256 };
+        static constexpr int32_t s_MAX_IOV { 64 };
+
+        TCPServer& m_server;
+        uint16_t const m_ID;
+        int32_t const m_ACC_SOCK;
+        int32_t const m_WAKE_FD;
+        int32_t m_write_len {};
+        std::array<char, s_FRAME_HEADER_SIZE + s_MAX_PAYLOAD + 1> m_write_buffer;
+        std::unique_ptr<Reactor> m_reactor;
+        LockFreeQueue<Broadcast> m_inbox;
+        History m_history;   // every shard sees every broadcast, so each keeps its own ring of the same buffers
+        ShardMetrics m_metrics;
+        std::atomic<bool> m_dump_requested {};
+
+        std::vector<Session> m_sessions;   // indexed by fd
+        std::vector<int32_t> m_clients;
+        std::vector<std::vector<int32_t>> m_subscribers;   // indexed by topic, grown on first join
+        std::vector<int32_t> m_doomed;
+        std::vector<int32_t> m_pending_flush;
+        TimingWheel m_timers;                   // handshake, heartbeat and idle deadlines, cookie is the fd
+        TimingWheel::Clock::time_point m_now;   // read once per loop iteration and once before timers fire
+        SharedBuffer const m_ping;
+        SharedBuffer const m_pong;
+    };
+
+    // Totals over all shards on stdout, then every shard lists its own connections
+    void m_log_stats() noexcept
+    {
+        ShardMetrics const* shards[256];
+        size_t count = std::min<size_t>(m_shards.size(), 256);
+        for (size_t shard_id {}; shard_id < count; ++shard_id) {
+            shards[shard_id] = &m_shards[shard_id]->metrics();
+        }
+        auto sum = [&](Counter ShardMetrics::*counter) {
+            uint64_t total {};
+            for (size_t shard_id {}; shard_id < count; ++shard_id) {
+                total += (shards[shard_id]->*counter).load();
+            }
+            return total;
+        };
+
+        char line[512];
+        int32_t len = std::snprintf(line, sizeof(line),
+                                    "Stats: %lu connections (%lu accepted, %lu closed, %lu handshaking, %lu handshake timeouts, %lu idle timeouts), in %lu B / %lu msgs, out %lu B / %lu msgs queued,"
+                                    " %lu B backlog, %lu send errors, %lu slow consumers, %lu inbox drops",
+                                    sum(&ShardMetrics::connections), sum(&ShardMetrics::accepted), sum(&ShardMetrics::closed),
+                                    sum(&ShardMetrics::handshakes), sum(&ShardMetrics::handshake_timeouts), sum(&ShardMetrics::idle_timeouts),
+                                    sum(&ShardMetrics::bytes_in), sum(&ShardMetrics::messages_in), sum(&ShardMetrics::bytes_out),
+                                    sum(&ShardMetrics::messages_out), sum(&ShardMetrics::queued_bytes), sum(&ShardMetrics::send_errors),
+                                    sum(&ShardMetrics::slow_consumers), sum(&ShardMetrics::inbox_drops));
+        LogToStdOut(line, std::clamp<int32_t>(len, 0, sizeof(line) - 1));
+        for (size_t shard_id {}; shard_id < count; ++shard_id) {
+            ShardMetrics const& shard = *shards[shard_id];
+            len                       = std::snprintf(line, sizeof(line),
+                                                      "  shard %zu: %lu connections, %lu loops (p50 <= %lu us, p99 <= %lu us), fan-out p50 <= %lu us, p99 <= %lu us",
+                                                      shard_id, shard.connections.load(), shard.loop_iterations.load(), shard.loop_latency.percentile_us(0.5),
+                                                      shard.loop_latency.percentile_us(0.99), shard.fanout_latency.percentile_us(0.5),
+                                                      shard.fanout_latency.percentile_us(0.99));
+            LogToStdOut(line, std::clamp<int32_t>(len, 0, sizeof(line) - 1));
+        }
+        for (auto& shard : m_shards) {
+            shard->request_dump();
         }
-        int32_t msg_len = std::sprintf(
-            m_write_buffer.data(),
-            "Message from [%s]: %.*s", m_client_uname_sock_map[m_pollfd_set[client_index].fd].c_str(), read_bytes, m_read_buffer.data());
-        m_write_buffer[msg_len] = 0;
-        return true;
     }
 
-    inline void m_close_client(int32_t client_index) noexcept
+    void m_render_metrics(std::string& out) const noexcept
     {
-        close(m_pollfd_set[client_index].fd);
-        m_pollfd_set[client_index].fd = m_pollfd_set[FD_INDEX::CLIENTS + m_conns - 1].fd;
-        m_conns--;
+        struct Family {
+            char const* name;
+            char const* type;
+            char const* help;
+            Counter ShardMetrics::*counter;
+        };
+        static constexpr Family s_FAMILIES[] {
+            { "cn_tcp_connections", "gauge", "Connected clients", &ShardMetrics::connections },
+            { "cn_tcp_accepted_total", "counter", "Connections admitted", &ShardMetrics::accepted },
+            { "cn_tcp_closed_total", "counter", "Connections closed", &ShardMetrics::closed },
+            { "cn_tcp_handshakes", "gauge", "Accepted connections waiting for HELLO", &ShardMetrics::handshakes },
+            { "cn_tcp_handshake_timeouts_total", "counter", "Connections closed for not sending HELLO in time", &ShardMetrics::handshake_timeouts },
+            { "cn_tcp_idle_timeouts_total", "counter", "Clients disconnected after idle_timeout of silence", &ShardMetrics::idle_timeouts },
+            { "cn_tcp_heartbeats_total", "counter", "PINGs sent to silent clients", &ShardMetrics::heartbeats },
+            { "cn_tcp_timers", "gauge", "Armed connection timers", &ShardMetrics::timers },
+            { "cn_tcp_received_bytes_total", "counter", "Bytes read from clients", &ShardMetrics::bytes_in },
+            { "cn_tcp_sent_bytes_total", "counter", "Bytes written to clients", &ShardMetrics::bytes_out },
+            { "cn_tcp_received_messages_total", "counter", "Chat frames received", &ShardMetrics::messages_in },
+            { "cn_tcp_queued_messages_total", "counter", "Frames queued to clients", &ShardMetrics::messages_out },
+            { "cn_tcp_send_errors_total", "counter", "Sends that failed with an error", &ShardMetrics::send_errors },
+            { "cn_tcp_slow_consumers_total", "counter", "Clients that crossed the high water mark", &ShardMetrics::slow_consumers },
+            { "cn_tcp_inbox_drops_total", "counter", "Broadcasts dropped on a full shard inbox", &ShardMetrics::inbox_drops },
+            { "cn_tcp_outbound_queued_bytes", "gauge", "Bytes waiting in outbound queues", &ShardMetrics::queued_bytes },
+            { "cn_tcp_loop_iterations_total", "counter", "Reactor loop iterations", &ShardMetrics::loop_iterations },
+            { "cn_tcp_history_bytes", "gauge", "Bytes of chat history kept for late joiners", &ShardMetrics::history_bytes },
+        };
+
+        char labels[32];
+        for (Family const& family : s_FAMILIES) {
+            AppendMetricHeader(out, family.name, family.type, family.help);
+            for (size_t shard_id {}; shard_id < m_shards.size(); ++shard_id) {
+                std::snprintf(labels, sizeof(labels), "shard=\"%zu\"", shard_id);
+                AppendMetric(out, family.name, labels, static_cast<double>((m_shards[shard_id]->metrics().*family.counter).load()));
+            }
+        }
+        AppendMetricHeader(out, "cn_tcp_loop_seconds", "histogram", "Time spent handling the events of one reactor wakeup");
+        for (size_t shard_id {}; shard_id < m_shards.size(); ++shard_id) {
+            std::snprintf(labels, sizeof(labels), "shard=\"%zu\"", shard_id);
+            AppendHistogram(out, "cn_tcp_loop_seconds", labels, m_shards[shard_id]->metrics().loop_latency);
+        }
+        AppendMetricHeader(out, "cn_tcp_fanout_seconds", "histogram", "Time to queue one broadcast to a shard's clients");
+        for (size_t shard_id {}; shard_id < m_shards.size(); ++shard_id) {
+            std::snprintf(labels, sizeof(labels), "shard=\"%zu\"", shard_id);
+            AppendHistogram(out, "cn_tcp_fanout_seconds", labels, m_shards[shard_id]->metrics().fanout_latency);
+        }
     }
 
-    void m_broadcast(int32_t client_index) noexcept
+    // Runs on its own thread and only reads the shards' counters, so a scrape never waits on or stalls a reactor.
+    // HTTP clients (curl --unix-socket) get a response header; anything else gets the bare text.
+    void m_serve_metrics() noexcept
     {
-        size_t msg_len = std::strlen(m_write_buffer.data());
-        std::for_each_n(m_pollfd_set.begin() + FD_INDEX::CLIENTS, m_conns, [=, index = int { FD_INDEX::CLIENTS }](pollfd const& poll_fd) mutable {
-            if (index != client_index) {
-                int32_t send_bytes = send(m_pollfd_set[index].fd, m_write_buffer.data(), msg_len, 0);
-                if (send_bytes == -1) {
-                    std::printf("client index: %d, index: %d", client_index, index);
-                    std::fputs("Could not send message\n", stderr);
-                    std::fflush(stderr);
+        std::string body;
+        for (;;) {
+            int32_t scrape_sock = accept4(m_metrics_sock, nullptr, nullptr, SOCK_CLOEXEC);
+            if (scrape_sock == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            timeval timeout { 0, 200 * 1000 };
+            setsockopt(scrape_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(scrape_sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            char request[512];
+            ssize_t request_len = recv(scrape_sock, request, sizeof(request), 0);
+
+            body.clear();
+            m_render_metrics(body);
+            std::string response;
+            if (request_len >= 4 && std::memcmp(request, "GET ", 4) == 0) {
+                response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+            }
+            response += body;
+            for (size_t sent {}; sent < response.size();) {
+                ssize_t n = send(scrape_sock, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    break;
                 }
+                sent += n;
             }
-            index += 1;
-        });
+            close(scrape_sock);
+        }
     }
 
-public:
-    static constexpr uint8_t s_MAX_CONNS { 50 };
-    static constexpr uint16_t s_MAX_BUFFER_SIZE { 1024 };
-    static constexpr uint16_t s_EXTRA_BUFFER_SIZE { 256 };
+    FanOutPolicy const m_policy;
+    std::atomic<bool> m_close_conn {};
+    std::atomic<uint32_t> m_next_id { 1 };
+    SocketAddress<Domain> m_TCPServer_address;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    int32_t m_metrics_sock { -1 };
+    SocketAddress<AF_UNIX> m_metrics_address;
+};
 
-private:
-    enum FD_INDEX {
-        STDIN,
-        ACCEPT,
-        CLIENTS
-    };
+// Lift the soft descriptor limit to the hard limit so the connection table is bounded by the system, not the default 1024
+void RaiseFdLimit() noexcept
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
 
-    int32_t const m_ACC_SOCK;
-    bool m_close_conn {};
-    uint8_t m_conns {};
-    sockaddr_in m_TCPServer_address;
-    std::array<char, s_MAX_BUFFER_SIZE + 1 + s_EXTRA_BUFFER_SIZE> m_read_buffer;
-    std::array<char, s_MAX_BUFFER_SIZE + 1 + s_EXTRA_BUFFER_SIZE> m_write_buffer;
-    std::array<pollfd, 2 + s_MAX_CONNS> m_pollfd_set;
+template <int32_t Domain>
+void Serve(char const* host, uint16_t port, uint16_t listeners, Backend backend, uint16_t threads, FanOutPolicy policy, char const* metrics_path) noexcept
+{
+    TCPServer<Domain> server { host, port, listeners, backend, threads, policy };
 
-    std::map<uint16_t, std::string> m_client_uname_sock_map;
-};
+    if (metrics_path != nullptr && !server.expose_metrics(metrics_path)) {
+        std::exit(EXIT_FAILURE);
+    }
+    server.start();
+}
 
 auto main(int32_t argc, char** argv) -> int32_t
 {
-    if (argc != 4) {
-        std::fprintf(stderr, "Usage: %s <IP> <PORT> <LISTENERS>", argv[0]);
+    if (argc < 4 || argc % 2 != 0) {
+        std::fprintf(stderr,
+                     "Usage: %s <IPv4 | IPv6 | unix:PATH | unix:@NAME> <PORT> <LISTENERS> [--backend poll|epoll|io_uring] [--threads N]"
+                     " [--high-water BYTES] [--low-water BYTES] [--slow-consumer drop|disconnect]"
+                     " [--segments nodelay|nagle|cork] [--history MESSAGES] [--history-bytes BYTES] [--handshake-timeout MS]"
+                     " [--heartbeat MS] [--idle-timeout MS]"
+                     " [--metrics SOCKET_PATH]\n",
+                     argv[0]);
         std::exit(64);
     }
 
-    TCPServer<AF_INET> server {
-        argv[1],
-        static_cast<uint16_t>(std::stoul(argv[2])),
-        static_cast<uint16_t>(std::stoul(argv[3]))
-    };
+    Backend backend  = _DEFAULT_BACKEND_;
+    uint16_t threads = 1;
+    FanOutPolicy policy;
+    char const* metrics_path {};
+    for (int32_t arg = 4; arg < argc; arg += 2) {
+        if (std::strcmp(argv[arg], "--backend") == 0 && std::strcmp(argv[arg + 1], "poll") == 0) {
+            backend = Backend::POLL;
+        } else if (std::strcmp(argv[arg], "--backend") == 0 && std::strcmp(argv[arg + 1], "epoll") == 0) {
+            backend = Backend::EPOLL;
+        } else if (std::strcmp(argv[arg], "--backend") == 0 && std::strcmp(argv[arg + 1], "io_uring") == 0) {
+            backend = Backend::IO_URING;
+        } else if (std::strcmp(argv[arg], "--threads") == 0) {
+            threads = static_cast<uint16_t>(std::stoul(argv[arg + 1]));
+        } else if (std::strcmp(argv[arg], "--high-water") == 0) {
+            policy.high_water = std::stoul(argv[arg + 1]);
+        } else if (std::strcmp(argv[arg], "--low-water") == 0) {
+            policy.low_water = std::stoul(argv[arg + 1]);
+        } else if (std::strcmp(argv[arg], "--slow-consumer") == 0 && std::strcmp(argv[arg + 1], "drop") == 0) {
+            policy.on_slow = SlowConsumer::DROP;
+        } else if (std::strcmp(argv[arg], "--slow-consumer") == 0 && std::strcmp(argv[arg + 1], "disconnect") == 0) {
+            policy.on_slow = SlowConsumer::DISCONNECT;
+        } else if (std::strcmp(argv[arg], "--segments") == 0 && std::strcmp(argv[arg + 1], "nodelay") == 0) {
+            policy.segments = SegmentPolicy::NODELAY;
+        } else if (std::strcmp(argv[arg], "--segments") == 0 && std::strcmp(argv[arg + 1], "nagle") == 0) {
+            policy.segments = SegmentPolicy::NAGLE;
+        } else if (std::strcmp(argv[arg], "--segments") == 0 && std::strcmp(argv[arg + 1], "cork") == 0) {
+            policy.segments = SegmentPolicy::CORK;
+        } else if (std::strcmp(argv[arg], "--history") == 0) {
+            policy.history_messages = std::stoul(argv[arg + 1]);
+        } else if (std::strcmp(argv[arg], "--history-bytes") == 0) {
+            policy.history_bytes = std::stoul(argv[arg + 1]);
+        } else if (std::strcmp(argv[arg], "--handshake-timeout") == 0) {
+            policy.handshake_timeout = std::chrono::milliseconds { std::stoul(argv[arg + 1]) };
+        } else if (std::strcmp(argv[arg], "--heartbeat") == 0) {
+            policy.heartbeat = std::chrono::milliseconds { std::stoul(argv[arg + 1]) };
+        } else if (std::strcmp(argv[arg], "--idle-timeout") == 0) {
+            policy.idle_timeout = std::chrono::milliseconds { std::stoul(argv[arg + 1]) };
+        } else if (std::strcmp(argv[arg], "--metrics") == 0) {
+            metrics_path = argv[arg + 1];
+        } else {
+            std::fprintf(stderr, "Unknown option %s %s\n", argv[arg], argv[arg + 1]);
+            std::exit(64);
+        }
+    }
 
-    server.start();
+    // A joiner's backlog counts against its high water mark like anything else queued to it
+    if (policy.history_bytes > policy.high_water / 2) {
+        policy.history_bytes = policy.high_water / 2;
+        std::fprintf(stderr, "History capped at %zu bytes, half the high water mark\n", policy.history_bytes);
+        std::fflush(stderr);
+    }
+
+    RaiseFdLimit();
+
+    uint16_t port      = static_cast<uint16_t>(std::stoul(argv[2]));
+    uint16_t listeners = static_cast<uint16_t>(std::stoul(argv[3]));
+    if (std::strncmp(argv[1], "unix:", 5) == 0) {
+        Serve<AF_UNIX>(argv[1] + 5, port, listeners, backend, threads, policy, metrics_path);
+    } else if (std::strchr(argv[1], ':') != nullptr) {
+        Serve<AF_INET6>(argv[1], port, listeners, backend, threads, policy, metrics_path);
+    } else {
+        Serve<AF_INET>(argv[1], port, listeners, backend, threads, policy, metrics_path);
+    }
 }
@@ -1,21 +1,228 @@
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 #include <string>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#include "Fragment.hpp"
 #include "Logger.hpp"
 #define UDP
 #include "Global.hpp"
 
+#define _MAX_BATCH_     1024UL
+#define _GRO_BUF_SIZE_  65535UL
+#define _RCVBUF_SIZE_   (4UL << 20)
+#define _STATS_PERIOD_  std::chrono::seconds(1)
+
+#define _REASSEMBLY_CAP_     (64UL << 20)
+#define _REASSEMBLY_TIMEOUT_ std::chrono::milliseconds(2000)
+#define _RECV_TICK_MS_       250
+
+// Accumulated over one reporting period. fill_histogram[k] counts recvmmsg calls that returned
+// between 2^k and 2^(k+1)-1 messages, which is what to look at when picking --batch.
+struct BatchStats {
+    size_t batches {};
+    size_t messages {};
+    size_t datagrams {};   // larger than messages once GRO coalesces segments
+    size_t bytes {};
+    size_t delivered {};   // complete messages out of the reassembler
+    size_t full_batches {};
+    size_t max_fill {};
+    std::array<size_t, 11> fill_histogram {};
+};
+
+void RecordBatch(BatchStats& stats, size_t fill, size_t batch_size) noexcept
+{
+    ++stats.batches;
+    stats.messages += fill;
+    stats.full_batches += fill == batch_size;
+    stats.max_fill = std::max(stats.max_fill, fill);
+    size_t bucket {};
+    while ((fill >> (bucket + 1)) != 0 && bucket + 1 < stats.fill_histogram.size()) {
+        ++bucket;
+    }
+    ++stats.fill_histogram[bucket];
+}
+
+void ReportBatchStats(BatchStats const& stats, Reassembler const& reassembler, double seconds) noexcept
+{
+    if (stats.batches == 0) {
+        return;
+    }
+    char line[512];
+    int32_t len = std::snprintf(line, sizeof(line),
+                                "batches %zu | avg fill %.1f | max fill %zu | full %.1f%% | %.0f dgram/s | %.2f MB/s | %zu delivered"
+                                " | %zu pending | %zu expired | %zu evicted | %zu recovered | %zu repairs | fill histogram",
+                                stats.batches,
+                                static_cast<double>(stats.messages) / stats.batches,
+                                stats.max_fill,
+                                100.0 * stats.full_batches / stats.batches,
+                                stats.datagrams / seconds,
+                                stats.bytes / seconds / 1e6,
+                                stats.delivered,
+                                reassembler.pending(),
+                                reassembler.stats().expired,
+                                reassembler.stats().evicted,
+                                reassembler.stats().recovered,
+                                reassembler.stats().repairs);
+    for (size_t bucket {}; bucket < stats.fill_histogram.size() && len < static_cast<int32_t>(sizeof(line)); ++bucket) {
+        if (stats.fill_histogram[bucket] != 0) {
+            len += std::snprintf(line + len, sizeof(line) - len, " %zu+:%zu", size_t { 1 } << bucket, stats.fill_histogram[bucket]);
+        }
+    }
+    LogToStdOut(line, std::min<size_t>(len, sizeof(line) - 1));
+}
+
+uint64_t PeerKey(sockaddr_in const& peer) noexcept
+{
+    return static_cast<uint64_t>(ntohl(peer.sin_addr.s_addr)) << 16 | ntohs(peer.sin_port);
+}
+
+// Feeds one datagram to the reassembler and logs the message it completes, if any
+bool HandleFragment(Reassembler& reassembler, sockaddr_in const& peer, char const* data, size_t len, bool echo, std::vector<char>& message) noexcept
+{
+    FragmentHeader header;
+    if (!DecodeFragmentHeader(data, len, header)) {
+        LOG_WARN("Dropping malformed fragment of " + std::to_string(len) + " bytes");
+        return false;
+    }
+    if (!reassembler.offer(PeerKey(peer), header, data + s_FRAGMENT_HEADER_SIZE, Reassembler::Clock::now(), message)) {
+        return false;
+    }
+    if (echo) {
+        LOG_INFO("Received " + std::to_string(message.size()) + " bytes in " + std::to_string(header.count) + " fragments from peer");
+        LogToStdOut(message.data(), message.size());
+    }
+    return true;
+}
+
+void ExpireFragments(Reassembler& reassembler, size_t& reported, size_t& recovered) noexcept
+{
+    reassembler.expire(Reassembler::Clock::now());
+    Reassembler::Stats const& stats = reassembler.stats();
+    if (stats.expired + stats.evicted != reported) {
+        reported = stats.expired + stats.evicted;
+        LOG_WARN("Dropped incomplete messages so far: " + std::to_string(reported));
+    }
+    if (stats.recovered != recovered) {
+        recovered = stats.recovered;
+        LOG_INFO("Recovered lost fragments so far: " + std::to_string(recovered) + " from " + std::to_string(stats.repairs)
+                 + " repair datagrams, " + std::to_string(stats.unused_repairs) + " of them unused");
+    }
+}
+
+// Pulls up to batch_size datagrams per recvmmsg. With GRO the kernel may hand back several
+// same-sized segments coalesced into one message; the segment size arrives as a UDP_GRO cmsg.
+// A zero-length datagram ends the run, as in the per-datagram loop.
+void ReceiveBatched(int32_t server_socket, size_t batch_size, bool gro, bool echo) noexcept
+{
+    size_t const slot_size = gro ? _GRO_BUF_SIZE_ : s_MAX_DATAGRAM;
+    std::unique_ptr<char[]> slab { new char[batch_size * slot_size] };
+    std::vector<iovec> iovecs(batch_size);
+    std::vector<sockaddr_in> peers(batch_size);
+    std::vector<mmsghdr> messages(batch_size);
+    std::vector<std::array<char, CMSG_SPACE(sizeof(int32_t))>> controls(batch_size);
+
+    for (size_t index {}; index < batch_size; ++index) {
+        iovecs[index] = { slab.get() + index * slot_size, slot_size };
+    }
+
+    Reassembler reassembler { _REASSEMBLY_CAP_, _REASSEMBLY_TIMEOUT_ };
+    std::vector<char> message;
+    size_t dropped {};
+    size_t recovered {};
+    BatchStats stats;
+    auto period_start = std::chrono::steady_clock::now();
+    for (bool running = true; running;) {
+        for (size_t index {}; index < batch_size; ++index) {
+            messages[index].msg_hdr             = {};
+            messages[index].msg_hdr.msg_name    = &peers[index];
+            messages[index].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[index].msg_hdr.msg_iov     = &iovecs[index];
+            messages[index].msg_hdr.msg_iovlen  = 1;
+            if (gro) {
+                messages[index].msg_hdr.msg_control    = controls[index].data();
+                messages[index].msg_hdr.msg_controllen = controls[index].size();
+            }
+        }
+        int32_t received = recvmmsg(server_socket, messages.data(), batch_size, MSG_WAITFORONE, nullptr);
+        if (received == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                ExpireFragments(reassembler, dropped, recovered);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            LogToStdErrAndTerminate("Could not receive complete message");
+        }
+        RecordBatch(stats, received, batch_size);
+
+        for (int32_t index {}; index < received; ++index) {
+            size_t length  = messages[index].msg_len;
+            size_t segment = length;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&messages[index].msg_hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&messages[index].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int32_t gso_size;
+                    std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                    segment = gso_size;
+                }
+            }
+            if (length == 0) {
+                running = false;
+                break;
+            }
+            // A GRO message is a run of equally sized datagrams, only the last may be shorter
+            char const* data = static_cast<char const*>(iovecs[index].iov_base);
+            for (size_t offset {}; offset < length; offset += segment) {
+                ++stats.datagrams;
+                stats.delivered += HandleFragment(reassembler, peers[index], data + offset, std::min(segment, length - offset), echo, message);
+            }
+            stats.bytes += length;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - period_start >= _STATS_PERIOD_ || !running) {
+            ExpireFragments(reassembler, dropped, recovered);
+            ReportBatchStats(stats, reassembler, std::chrono::duration<double>(now - period_start).count());
+            stats        = {};
+            period_start = now;
+        }
+    }
+}
+
 int32_t main(int32_t argc, char** argv)
 {
-    std::array<char, _BUF_SIZE_> buffer;
+    std::array<char, s_MAX_DATAGRAM> buffer;
     buffer.fill(0);
 
-    if (argc != 3) {
-        LogToStdErrAndTerminate(std::string("Usage: ") + argv[0] + " <IP> <PORT>");
+    if (argc < 3) {
+        LogToStdErrAndTerminate(std::string("Usage: ") + argv[0] + " <IP> <PORT> [--batch N] [--gro] [--echo]");
+    }
+
+    size_t batch_size {};
+    bool gro {};
+    bool echo {};
+    for (int32_t arg = 3; arg < argc; ++arg) {
+        if (std::strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc) {
+            batch_size = std::clamp<size_t>(std::stoul(argv[++arg]), 1, _MAX_BATCH_);
+        } else if (std::strcmp(argv[arg], "--gro") == 0) {
+            gro = true;
+        } else if (std::strcmp(argv[arg], "--echo") == 0) {
+            echo = true;
+        } else {
+            LogToStdErrAndTerminate(std::string("Unknown option ") + argv[arg]);
+        }
     }
 
     int32_t server_socket = socket(_SOCK_ADDR_TYPE_, _SOCK_PROTO_TYPE_, 0);
@@ -29,16 +236,48 @@ int32_t main(int32_t argc, char** argv)
         LogToStdErrAndTerminate("Could not bind server to the given address");
     }
 
-    for (size_t numOfBytes;;) {
-        numOfBytes = recvfrom(server_socket, buffer.data(), _BUF_SIZE_, 0, nullptr, nullptr);
+    // Room for whole fragment bursts, and a periodic wakeup even when idle so partial messages still time out
+    int32_t rcvbuf = static_cast<int32_t>(_RCVBUF_SIZE_);
+    timeval tick { 0, _RECV_TICK_MS_ * 1000 };
+    setsockopt(server_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(server_socket, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick));
+
+    if (batch_size != 0 || gro) {
+        int32_t enable { 1 };
+        if (gro && setsockopt(server_socket, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == -1) {
+            LOG_WARN("UDP_GRO unsupported, receiving without it");
+            gro = false;
+        }
+        ReceiveBatched(server_socket, batch_size != 0 ? batch_size : 64, gro, echo);
+        close(server_socket);
+        return 0;
+    }
+
+    Reassembler reassembler { _REASSEMBLY_CAP_, _REASSEMBLY_TIMEOUT_ };
+    std::vector<char> message;
+    size_t dropped {};
+    size_t recovered {};
+    auto last_expiry = Reassembler::Clock::now();
+    for (ssize_t numOfBytes;;) {
+        sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        numOfBytes         = recvfrom(server_socket, buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr*>(&peer), &peer_len);
         if (numOfBytes == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                ExpireFragments(reassembler, dropped, recovered);
+                continue;
+            }
             LogToStdErrAndTerminate("Could not receive complete message");
         } else if (numOfBytes == 0) {
             break;
         }
-        LogToStdOut("Received " + std::to_string(numOfBytes) + " bytes from peer");
-        LogToStdOut(buffer.data(), numOfBytes);
+        HandleFragment(reassembler, peer, buffer.data(), numOfBytes, true, message);
+        if (Reassembler::Clock::now() - last_expiry >= std::chrono::milliseconds(_RECV_TICK_MS_)) {
+            ExpireFragments(reassembler, dropped, recovered);
+            last_expiry = Reassembler::Clock::now();
+        }
     }
+    ExpireFragments(reassembler, dropped, recovered);
 
     close(server_socket);
-}
\ No newline at end of file
+}